@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <array>
 #include <cerrno>
 #include <cstddef>
@@ -9,7 +10,6 @@
 #include <cctype>
 #include <cstdint>
 #include <cstdio>
-#include <cstring>
 
 #include <hardware/i2c.h>
 #include <hardware/structs/io_bank0.h>
@@ -20,10 +20,225 @@
 
 #include "hardware/adc.h"
 #include "hardware/clocks.h"
+#include "hardware/dma.h"
 #include "hardware/gpio.h"
+#include "hardware/pio.h"
 #include "hardware/pwm.h"
+#include "hardware/sync.h"
 #include "pico/stdlib.h"
 
+#include "onewire.pio.h"
+
+// Logging. Everything below LOG_LEVEL compiles to nothing, arguments included.
+// Hot paths (1-wire slots, pixel writes) use TRACE instead of printf: it stores
+// an 8-byte record in a RAM ring and returns, and the records are only
+// formatted and printed by drainTrace(), which the main loop calls when it has
+// time to spare.
+#define LOG_LEVEL_NONE 0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_INFO 2
+#define LOG_LEVEL_DEBUG 3
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_ERROR
+#define LOG_ERROR(...) printf(__VA_ARGS__)
+#else
+#define LOG_ERROR(...) ((void)0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_INFO
+#define LOG_INFO(...) printf(__VA_ARGS__)
+#else
+#define LOG_INFO(...) ((void)0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(...) printf(__VA_ARGS__)
+#define TRACE(event, arg) traceRing.record(TraceEvent::event, arg)
+#else
+#define LOG_DEBUG(...) ((void)0)
+#define TRACE(event, arg) ((void)0)
+#endif
+
+enum class TraceEvent : uint16_t {
+  OneWireReset,
+  OneWireWrite,
+  OneWireRead,
+  ConversionStarted,
+  ConversionFinished,
+  SetPixel,
+  CrcError,
+};
+
+const char *traceEventName(TraceEvent event) {
+  switch (event) {
+  case TraceEvent::OneWireReset:
+    return "1-wire reset";
+  case TraceEvent::OneWireWrite:
+    return "1-wire write";
+  case TraceEvent::OneWireRead:
+    return "1-wire read";
+  case TraceEvent::ConversionStarted:
+    return "convert start";
+  case TraceEvent::ConversionFinished:
+    return "convert done";
+  case TraceEvent::SetPixel:
+    return "set pixel";
+  case TraceEvent::CrcError:
+    return "CRC error";
+  }
+  return "?";
+}
+
+struct TraceRecord {
+  uint32_t timeUs;
+  TraceEvent event;
+  uint16_t arg;
+};
+
+// record() masks interrupts for the few instructions it needs, so IRQ
+// handlers and main code can both trace; drain() is lock-free but must only
+// be called from one place at a time. When full, new records are dropped and
+// counted rather than blocking the producer.
+template <size_t N> class TraceRing {
+  static_assert((N & (N - 1)) == 0, "N must be a power of two");
+
+public:
+  void record(TraceEvent event, uint16_t arg) {
+    const uint32_t status = save_and_disable_interrupts();
+    const uint32_t head = head_;
+    if (head - tail_ == N) {
+      ++dropped_;
+    } else {
+      records_[head & (N - 1)] = {time_us_32(), event, arg};
+      __dmb();
+      head_ = head + 1;
+    }
+    restore_interrupts(status);
+  }
+
+  template <typename F> size_t drain(F &&consume) {
+    size_t drained = 0;
+    while (tail_ != head_) {
+      const TraceRecord record = records_[tail_ & (N - 1)];
+      __dmb();
+      tail_ = tail_ + 1;
+      consume(record);
+      ++drained;
+    }
+    return drained;
+  }
+
+  uint32_t dropped() const { return dropped_; }
+
+private:
+  std::array<TraceRecord, N> records_;
+  volatile uint32_t head_ = 0;
+  volatile uint32_t tail_ = 0;
+  volatile uint32_t dropped_ = 0;
+};
+
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+TraceRing<256> traceRing;
+
+void drainTrace() {
+  static uint32_t reportedDrops = 0;
+  traceRing.drain([](const TraceRecord &record) {
+    printf("%10lu %-14s 0x%04X\n", static_cast<unsigned long>(record.timeUs),
+           traceEventName(record.event), record.arg);
+  });
+  if (traceRing.dropped() != reportedDrops) {
+    printf("%lu trace records dropped\n",
+           static_cast<unsigned long>(traceRing.dropped() - reportedDrops));
+    reportedDrops = traceRing.dropped();
+  }
+}
+#else
+void drainTrace() {}
+#endif
+
+// Paces a render loop at a fixed rate. A repeating timer ticks at absolute
+// deadlines, start + k * period, so the rate does not drift with however
+// long each frame takes. A frame that finishes after the next tick counts as
+// missed. With dropping on, a loop that has fallen behind skips straight to
+// the newest tick instead of rendering the backlog back to back.
+class FrameClock {
+public:
+  explicit FrameClock(uint32_t periodUs, bool dropLateFrames = true)
+      : periodUs_(periodUs), dropLateFrames_(dropLateFrames),
+        startUs_(time_us_64()) {
+    // Negative: from one tick's deadline to the next, not from when the
+    // callback ran.
+    bool success = add_repeating_timer_us(-int64_t(periodUs_),
+                                          &FrameClock::onTick, this, &timer_);
+    hard_assert(success);
+  }
+
+  ~FrameClock() { cancel_repeating_timer(&timer_); }
+
+  // Sleeps until the next frame is due. Returns how many ticks were dropped
+  // on the way, so animations can advance by the time that really passed.
+  uint32_t waitForFrame() {
+    while (ticks_ == frame_) {
+      __wfe();
+    }
+    const uint32_t ticks = ticks_;
+    uint32_t dropped = 0;
+    if (dropLateFrames_) {
+      dropped = ticks - frame_ - 1;
+      frame_ = ticks;
+    } else {
+      ++frame_;
+    }
+    droppedFrames_ += dropped;
+    frameStartUs_ = time_us_64();
+    return dropped;
+  }
+
+  // Marks the work for the current frame done, e.g. once it has been handed
+  // to DMA.
+  void frameDone() {
+    const uint64_t nowUs = time_us_64();
+    const uint64_t deadlineUs = startUs_ + uint64_t(frame_ + 1) * periodUs_;
+    frameUs_ = nowUs - frameStartUs_;
+    slackUs_ = int64_t(deadlineUs - nowUs);
+    if (slackUs_ < 0) {
+      ++missedFrames_;
+    }
+  }
+
+  uint32_t periodUs() const { return periodUs_; }
+  uint32_t frames() const { return frame_; }
+  // Time between waitForFrame() returning and frameDone().
+  uint32_t frameUs() const { return frameUs_; }
+  // How long before its deadline the last frame was done; negative if late.
+  int32_t slackUs() const { return slackUs_; }
+  uint32_t missedFrames() const { return missedFrames_; }
+  uint32_t droppedFrames() const { return droppedFrames_; }
+
+private:
+  static bool onTick(repeating_timer_t *timer) {
+    ++static_cast<FrameClock *>(timer->user_data)->ticks_;
+    return true;
+  }
+
+private:
+  const uint32_t periodUs_;
+  const bool dropLateFrames_;
+  const uint64_t startUs_;
+  repeating_timer_t timer_;
+  volatile uint32_t ticks_ = 0;
+  uint32_t frame_ = 0;
+  uint64_t frameStartUs_ = 0;
+  uint32_t frameUs_ = 0;
+  int32_t slackUs_ = 0;
+  uint32_t missedFrames_ = 0;
+  uint32_t droppedFrames_ = 0;
+};
+
 class Led {
 public:
   explicit Led(int pin) : pin_(pin) {
@@ -79,9 +294,9 @@ public:
     gpio_init(pin_);
     gpio_set_dir(pin_, GPIO_IN);
     gpio_pull_down(pin_);
-    printf("Starting PIR warm up...\n");
+    LOG_INFO("Starting PIR warm up...\n");
     sleep_ms(10'000); // Warm up
-    printf("PIR warm up finished\n");
+    LOG_INFO("PIR warm up finished\n");
   }
 
   bool hasDetection() const {
@@ -168,130 +383,450 @@ private:
   const float clockDivider_;
 };
 
+// Dallas/Maxim CRC8 (x^8 + x^5 + x^4 + 1, reflected), one table lookup per
+// byte. Running it over data that ends in its own CRC gives 0.
+constexpr std::array<uint8_t, 256> makeCrc8Table() {
+  std::array<uint8_t, 256> table = {};
+  for (int i = 0; i < 256; ++i) {
+    uint8_t crc = i;
+    for (int bit = 0; bit < 8; ++bit) {
+      crc = (crc & 1) ? (crc >> 1) ^ 0x8C : crc >> 1;
+    }
+    table[i] = crc;
+  }
+  return table;
+}
+
+constexpr std::array<uint8_t, 256> kCrc8Table = makeCrc8Table();
+
+uint8_t crc8(const uint8_t *data, size_t size) {
+  uint8_t crc = 0;
+  for (size_t i = 0; i < size; ++i) {
+    crc = kCrc8Table[crc ^ data[i]];
+  }
+  return crc;
+}
+
+// All DS18B20s on one 1-wire pin. The bus timing comes from the onewire PIO
+// program, and DMA moves the bytes in and out of it, so an interrupt can no
+// longer stretch a slot and the CPU sleeps through the transfers instead of
+// bit-banging them. One broadcast conversion serves every sensor; readings
+// are then collected one sensor at a time by ROM code.
 class DS18B20 {
 public:
-  explicit DS18B20(int pin) : pin_(pin) {}
+  explicit DS18B20(int pin) : pin_(pin) {
+    bool success = pio_claim_free_sm_and_add_program_for_gpio_range(
+        &onewire_program, &pio_, &sm_, &offset_, pin_, 1, true);
+    hard_assert(success);
 
-  std::optional<float> getTemperature() {
-    if (!initialize()) {
-      return {};
+    onewire_program_init(pio_, sm_, offset_, pin_);
+    setupDma();
+  }
+
+  ~DS18B20() {
+    if (state_ == State::Converting) {
+      cancel_alarm(alarm_);
     }
-    // printf("rom: %llu\n", readRom());
-    skipRom();
+    dma_channel_unclaim(txDma_);
+    dma_channel_unclaim(rxDma_);
+    pio_remove_program_and_unclaim_sm(&onewire_program, pio_, sm_, offset_);
+  }
 
-    // Convert T
-    constexpr uint8_t CONVERT_T = 0x44;
-    printf("Converting temperature started\n");
-    writeByte(CONVERT_T);
-    while (!readBit()) {
+  enum class Status {
+    Ok,
+    Busy,       // A conversion is still running.
+    NotStarted, // readResult() without a finished startConversion().
+    NoDevice,   // Nobody answered the reset pulse.
+    Timeout,    // The conversion never reported done.
+    CrcError,   // Every attempt read back a corrupted scratchpad.
+  };
+
+  static const char *describe(Status status) {
+    switch (status) {
+    case Status::Ok:
+      return "ok";
+    case Status::Busy:
+      return "busy";
+    case Status::NotStarted:
+      return "not started";
+    case Status::NoDevice:
+      return "no device";
+    case Status::Timeout:
+      return "timeout";
+    case Status::CrcError:
+      return "CRC error";
+    }
+    return "?";
+  }
+
+  // Starts a conversion and returns right away. An alarm then polls the
+  // sensor in the background until conversionDone(), which takes up to
+  // 750 ms at 12 bits; collect the reading with readResult().
+  Status startConversion() {
+    if (state_ == State::Converting) {
+      return Status::Busy;
     }
-    printf("Converting temperature finished\n");
+    state_ = State::Idle;
+    if (!reset()) {
+      return Status::NoDevice;
+    }
+    std::array<uint8_t, 2> convert = {SKIP_ROM, CONVERT_T};
+    transfer(convert);
+    TRACE(ConversionStarted, 0);
+
+    deadline_ = make_timeout_time_ms(kMaxConversionMs);
+    pollPending_ = false;
+    state_ = State::Converting;
+    alarm_ = add_alarm_in_ms(kPollIntervalMs, onAlarm, this, true);
+    return Status::Ok;
+  }
+
+  bool conversionDone() const { return state_ != State::Converting; }
 
-    if (!initialize()) {
+  // Result of the last conversion from the only sensor on the bus.
+  Status readResult(float &celsius) {
+    return readResult(nullptr, celsius);
+  }
+
+  // Result of the last conversion from sensor |index| of searchSensors().
+  Status readResult(size_t index, float &celsius) {
+    if (index >= numSensors_) {
+      return Status::NoDevice;
+    }
+    return readResult(&roms_[index], celsius);
+  }
+
+  // With the check on (the default), scratchpad and ROM reads that fail the
+  // CRC are retried up to |maxRetries| times, waiting |backoffUs| before
+  // the first retry and twice as long before each one after. With it off,
+  // reads stop after the two temperature bytes, which saves 7 of the 9
+  // scratchpad bytes on the bus; the reset that starts the next command
+  // cuts the sensor short.
+  void setCrcCheck(bool enabled) { checkCrc_ = enabled; }
+  void setRetries(int maxRetries, uint32_t backoffUs) {
+    maxRetries_ = maxRetries;
+    retryBackoffUs_ = backoffUs;
+  }
+
+  uint32_t crcFailures() const { return crcFailures_; }
+  uint32_t retries() const { return retries_; }
+
+  // Finds every device on the bus with SEARCH ROM and remembers their ROM
+  // codes, up to kMaxSensors. Returns how many were found.
+  size_t searchSensors() {
+    if (state_ == State::Converting) {
+      return 0;
+    }
+    for (int attempt = 0;; ++attempt) {
+      if (searchAll()) {
+        return numSensors_;
+      }
+      if (!retryAfter(attempt)) {
+        numSensors_ = 0;
+        return 0;
+      }
+    }
+  }
+
+  size_t numSensors() const { return numSensors_; }
+  uint64_t rom(size_t index) const { return roms_[index]; }
+
+  // ROM code of the only device on the bus; garbage if there are several.
+  std::optional<uint64_t> readRom() {
+    if (state_ == State::Converting) {
       return {};
     }
-    // printf("rom: %llu\n", readRom());
-    skipRom();
-    // Read scratchpad
-    printf("Reading temperature\n");
-    constexpr uint8_t READ_SCRATCHPAD = 0xBE;
-    writeByte(READ_SCRATCHPAD);
-    std::array<uint8_t, 9> scratchpad{0};
-    readBytes(scratchpad);
+    for (int attempt = 0;; ++attempt) {
+      if (!reset()) {
+        return {};
+      }
+      std::array<uint8_t, 9> frame = {READ_ROM};
+      std::fill(frame.begin() + 1, frame.end(), 0xFF);
+      transfer(frame);
+      if (crcMatches(frame.data() + 1, 8)) {
+        uint64_t rom = 0;
+        for (int i = 0; i < 8; ++i) {
+          rom |= uint64_t(frame[1 + i]) << (8 * i);
+        }
+        return rom;
+      }
+      if (!retryAfter(attempt)) {
+        return {};
+      }
+    }
+  }
 
-    printf("scratchpad:\n");
-    for (const auto &byte : scratchpad) {
-      printf("%d\n", byte);
+  // Blocking convenience wrapper around the calls above.
+  std::optional<float> getTemperature() {
+    if (startConversion() != Status::Ok) {
+      return {};
     }
-    return decodeTemperature(scratchpad[0], scratchpad[1]);
+    while (!conversionDone()) {
+      sleep_ms(kPollIntervalMs);
+    }
+    float celsius;
+    if (readResult(celsius) != Status::Ok) {
+      return {};
+    }
+    return celsius;
   }
 
+  static constexpr size_t kMaxSensors = 8;
+
 private:
-  bool initialize() {
-    printf("Initializing\n");
-    gpio_init(pin_);
+  static constexpr uint8_t READ_ROM = 0x33;
+  static constexpr uint8_t MATCH_ROM = 0x55;
+  static constexpr uint8_t SKIP_ROM = 0xCC;
+  static constexpr uint8_t SEARCH_ROM = 0xF0;
+  static constexpr uint8_t CONVERT_T = 0x44;
+  static constexpr uint8_t READ_SCRATCHPAD = 0xBE;
 
-    // Reset pulse
-    printf("Reset pulse\n");
-    gpio_set_dir(pin_, GPIO_OUT);
-    gpio_put(pin_, 0);
-    sleep_us(480);
+  static constexpr int kSearchFailed = -2;
 
-    // Check for response
-    gpio_set_dir(pin_, GPIO_IN);
-    sleep_us(60);
-    const bool isPresent = (gpio_get(pin_) == 0);
-    sleep_us(240);
-    const bool wasReleased = (gpio_get(pin_) == 1);
-    sleep_us(240);
-    printf("isPresent = %d, wasReleased = %d\n", isPresent, wasReleased);
-    return isPresent && wasReleased;
+  static constexpr uint32_t kMaxConversionMs = 1000;
+  static constexpr uint32_t kPollIntervalMs = 10;
+  // 8 slots of 66 us, see onewire.pio.
+  static constexpr uint32_t kByteUs = 8 * 66;
+  // A poll byte is read back well within this.
+  static constexpr uint32_t kPollAnswerUs = kByteUs + 100;
+
+  enum class State : uint8_t { Idle, Converting, Ready, TimedOut };
+
+  // Readings stay available until the next startConversion().
+  Status resultStatus() const {
+    switch (state_) {
+    case State::Converting:
+      return Status::Busy;
+    case State::TimedOut:
+      return Status::Timeout;
+    case State::Ready:
+      return Status::Ok;
+    default:
+      return Status::NotStarted;
+    }
   }
 
-  void writeBit(bool bit) {
-    gpio_set_dir(pin_, GPIO_OUT);
-    if (bit) {
-      gpio_put(pin_, 0);
-      sleep_us(5);
-      gpio_set_dir(pin_, GPIO_IN);
-      sleep_us(55);
+  Status readResult(const uint64_t *rom, float &celsius) {
+    const Status status = resultStatus();
+    if (status != Status::Ok) {
+      return status;
+    }
+    for (int attempt = 0;; ++attempt) {
+      std::array<uint8_t, 9> scratchpad;
+      const Status read = readScratchpad(rom, scratchpad);
+      if (read == Status::Ok) {
+        celsius = decodeTemperature(scratchpad[0], scratchpad[1]);
+        return Status::Ok;
+      }
+      if (read != Status::CrcError || !retryAfter(attempt)) {
+        return read;
+      }
+    }
+  }
+
+  // One READ SCRATCHPAD, addressed to |rom| or, if null, to whoever is on
+  // the bus. Without the CRC check only the first two bytes are filled in.
+  Status readScratchpad(const uint64_t *rom,
+                        std::array<uint8_t, 9> &scratchpad) {
+    if (!reset()) {
+      return Status::NoDevice;
+    }
+    std::array<uint8_t, 19> frame;
+    size_t size = 0;
+    if (rom != nullptr) {
+      frame[size++] = MATCH_ROM;
+      for (int i = 0; i < 8; ++i) {
+        frame[size++] = *rom >> (8 * i);
+      }
     } else {
-      gpio_put(pin_, 0);
-      sleep_us(60);
-      gpio_set_dir(pin_, GPIO_IN);
-      sleep_us(10);
+      frame[size++] = SKIP_ROM;
     }
+    frame[size++] = READ_SCRATCHPAD;
+    const size_t data = size;
+    const size_t dataSize = checkCrc_ ? scratchpad.size() : 2;
+    std::fill_n(frame.begin() + data, dataSize, 0xFF);
+    size += dataSize;
+    transfer(frame.data(), size);
+    std::copy_n(frame.begin() + data, dataSize, scratchpad.begin());
+    if (checkCrc_ && !crcMatches(scratchpad.data(), scratchpad.size())) {
+      return Status::CrcError;
+    }
+    return Status::Ok;
   }
 
-  bool readBit() {
-    gpio_set_dir(pin_, GPIO_OUT);
-    gpio_put(pin_, 0);
-    sleep_us(5);
+  // |data| ends in its CRC8. Always true with the check off.
+  bool crcMatches(const uint8_t *data, size_t size) {
+    if (!checkCrc_ || crc8(data, size) == 0) {
+      return true;
+    }
+    ++crcFailures_;
+    TRACE(CrcError, data[size - 1]);
+    return false;
+  }
 
-    gpio_set_dir(pin_, GPIO_IN);
-    sleep_us(10);
-    const bool bit = gpio_get(pin_);
-    sleep_us(55);
+  // Waits out the backoff before retry |attempt| + 1, or returns false if
+  // that would be one too many.
+  bool retryAfter(int attempt) {
+    if (attempt >= maxRetries_) {
+      return false;
+    }
+    ++retries_;
+    sleep_us(retryBackoffUs_ << attempt);
+    return true;
+  }
 
-    return bit;
+  // Searches the whole ROM tree once. False if a ROM code came back
+  // corrupted, or a branch that was there on the last pass went quiet; the
+  // table then holds whatever was found before it.
+  bool searchAll() {
+    numSensors_ = 0;
+    int lastDiscrepancy = -1;
+    uint64_t rom = 0;
+    do {
+      const int discrepancy = searchNext(lastDiscrepancy, rom);
+      if (discrepancy == kSearchFailed) {
+        return numSensors_ == 0;
+      }
+      uint8_t bytes[8];
+      for (int i = 0; i < 8; ++i) {
+        bytes[i] = rom >> (8 * i);
+      }
+      if (!crcMatches(bytes, sizeof(bytes))) {
+        return false;
+      }
+      roms_[numSensors_++] = rom;
+      lastDiscrepancy = discrepancy;
+    } while (lastDiscrepancy >= 0 && numSensors_ < kMaxSensors);
+    return true;
   }
 
-  void writeByte(uint8_t byte) {
-    printf("Writing byte: %02X\n", byte);
-    for (int i = 0; i < 8; ++i) {
-      writeBit(byte & 1);
-      byte >>= 1;
+  // One pass of the ROM search (Maxim AN187): at every bit where devices
+  // disagree, takes the 1 branch at |lastDiscrepancy|, repeats the previous
+  // choice before it and the 0 branch after it. Leaves the ROM found in
+  // |rom| and returns the new last discrepancy (-1 once the tree is
+  // exhausted), or kSearchFailed if nobody answered.
+  int searchNext(int lastDiscrepancy, uint64_t &rom) {
+    if (!reset()) {
+      return kSearchFailed;
+    }
+    writeByte(SEARCH_ROM);
+    onewire_set_bits_per_word(pio_, sm_, offset_, pin_, 1);
+    int discrepancy = -1;
+    bool failed = false;
+    for (int bit = 0; bit < 64; ++bit) {
+      const bool idBit = slot(1);
+      const bool complementBit = slot(1);
+      bool direction;
+      if (idBit && complementBit) {
+        failed = true;
+        break;
+      } else if (idBit != complementBit) {
+        direction = idBit;
+      } else if (bit < lastDiscrepancy) {
+        direction = (rom >> bit) & 1;
+      } else {
+        direction = bit == lastDiscrepancy;
+      }
+      if (idBit == complementBit && !direction) {
+        discrepancy = bit;
+      }
+      rom = (rom & ~(uint64_t(1) << bit)) | (uint64_t(direction) << bit);
+      slot(direction);
     }
+    onewire_set_bits_per_word(pio_, sm_, offset_, pin_, 8);
+    return failed ? kSearchFailed : discrepancy;
+  }
+
+  // A single slot; only between onewire_set_bits_per_word(..., 1) and
+  // (..., 8).
+  bool slot(bool bit) {
+    pio_sm_put_blocking(pio_, sm_, bit);
+    return pio_sm_get_blocking(pio_, sm_) >> 31;
+  }
+
+  static int64_t onAlarm(alarm_id_t id, void *userData) {
+    return static_cast<DS18B20 *>(userData)->pollConversion();
   }
 
-  uint8_t readByte() {
-    uint8_t byte = 0;
-    for (int i = 0; i < 8; ++i) {
-      if (readBit()) {
-        byte |= (1 << i);
+  // Runs in the alarm IRQ every kPollIntervalMs while converting. The main
+  // code stays off the bus until the state changes, so this may use the
+  // FIFOs directly: one read byte goes out, and the next call picks up the
+  // answer. The sensor holds read slots low until it is done.
+  int64_t pollConversion() {
+    if (pollPending_) {
+      pollPending_ = false;
+      if (pio_sm_get(pio_, sm_) >> 24 != 0) {
+        TRACE(ConversionFinished, 0);
+        state_ = State::Ready;
+        return 0;
       }
+      if (time_reached(deadline_)) {
+        state_ = State::TimedOut;
+        return 0;
+      }
+      return 1000 * kPollIntervalMs - kPollAnswerUs;
     }
-    printf("Read byte: %02X\n", byte);
-    return byte;
+    pio_sm_put(pio_, sm_, 0xFF);
+    pollPending_ = true;
+    return kPollAnswerUs;
   }
 
-  template <size_t N> void readBytes(std::array<uint8_t, N> &bytes) {
-    for (auto &byte : bytes) {
-      byte = readByte();
-    }
+  void setupDma() {
+    txDma_ = dma_claim_unused_channel(true);
+    dma_channel_config tx = dma_channel_get_default_config(txDma_);
+    channel_config_set_transfer_data_size(&tx, DMA_SIZE_8);
+    channel_config_set_read_increment(&tx, true);
+    channel_config_set_write_increment(&tx, false);
+    channel_config_set_dreq(&tx, pio_get_dreq(pio_, sm_, true));
+    dma_channel_configure(txDma_, &tx, &pio_->txf[sm_], nullptr, 0, false);
+
+    rxDma_ = dma_claim_unused_channel(true);
+    dma_channel_config rx = dma_channel_get_default_config(rxDma_);
+    channel_config_set_transfer_data_size(&rx, DMA_SIZE_8);
+    channel_config_set_read_increment(&rx, false);
+    channel_config_set_write_increment(&rx, true);
+    channel_config_set_dreq(&rx, pio_get_dreq(pio_, sm_, false));
+    // Autopush shifts right, so each byte read sits in the top byte lane.
+    const volatile void *rxByte =
+        reinterpret_cast<const volatile uint8_t *>(&pio_->rxf[sm_]) + 3;
+    dma_channel_configure(rxDma_, &rx, nullptr, rxByte, 0, false);
+  }
+
+  bool reset() {
+    pio_sm_exec_wait_blocking(pio_, sm_,
+                              pio_encode_jmp(offset_ + onewire_offset_reset));
+    const bool isPresent = (pio_sm_get_blocking(pio_, sm_) >> 31) == 0;
+    TRACE(OneWireReset, isPresent);
+    return isPresent;
   }
 
-  uint64_t readRom() {
-    writeByte(0x33);
-    uint64_t rom;
-    for (int i = 0; i < 4; ++i) {
-      rom |= (readByte() << (i * 8));
+  // Sends |size| bytes LSB first and replaces each one with the byte read
+  // back during its slots, so 0xFF reads a byte.
+  void transfer(uint8_t *bytes, size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+      TRACE(OneWireWrite, bytes[i]);
+    }
+    // Every byte written pushes one back; RX goes first so it is ready.
+    dma_channel_set_write_addr(rxDma_, bytes, false);
+    dma_channel_set_trans_count(rxDma_, size, true);
+    dma_channel_set_read_addr(txDma_, bytes, false);
+    dma_channel_set_trans_count(txDma_, size, true);
+    sleep_us(size * kByteUs);
+    dma_channel_wait_for_finish_blocking(rxDma_);
+    for (size_t i = 0; i < size; ++i) {
+      TRACE(OneWireRead, bytes[i]);
     }
-    return rom;
-    // My rom was 4294967295
   }
 
-  void skipRom() { writeByte(0xCC); }
+  template <size_t N> void transfer(std::array<uint8_t, N> &bytes) {
+    transfer(bytes.data(), N);
+  }
+
+  void writeByte(uint8_t byte) {
+    std::array<uint8_t, 1> bytes = {byte};
+    transfer(bytes);
+  }
+
 
   float decodeTemperature(uint8_t lsb, uint8_t msb) {
     int16_t rawTemperature =
@@ -302,6 +837,25 @@ private:
 
 private:
   int pin_;
+  PIO pio_;
+  uint sm_;
+  uint offset_;
+  uint txDma_;
+  uint rxDma_;
+
+  volatile State state_ = State::Idle;
+  alarm_id_t alarm_ = 0;
+  absolute_time_t deadline_;
+  bool pollPending_ = false;
+
+  std::array<uint64_t, kMaxSensors> roms_ = {};
+  size_t numSensors_ = 0;
+
+  bool checkCrc_ = true;
+  int maxRetries_ = 2;
+  uint32_t retryBackoffUs_ = 1000;
+  uint32_t crcFailures_ = 0;
+  uint32_t retries_ = 0;
 };
 
 constexpr std::array<std::array<uint8_t, 5>, 96> kFont5x8 = {{
@@ -372,27 +926,76 @@ public:
 
   const uint8_t *data() const { return buffer_.data(); }
 
-  void clear() { std::fill(buffer_.begin(), buffer_.end(), 0x00); }
+  static constexpr int size() { return kWidth * kPages; }
+  static constexpr int width() { return kWidth; }
+  static constexpr int pages() { return kPages; }
+
+  // Columns of a page modified since the last markClean(). Empty when
+  // first > last.
+  struct ColumnRange {
+    int first;
+    int last;
+
+    bool empty() const { return first > last; }
+  };
+
+  const ColumnRange &dirtyColumns(int page) const { return dirty_[page]; }
+
+  void markClean() {
+    for (auto &range : dirty_) {
+      range = {kWidth, -1};
+    }
+  }
+
+  void clear() {
+    for (int page = 0; page < kPages; ++page) {
+      for (int x = 0; x < kWidth; ++x) {
+        if (buffer_[page * kWidth + x] != 0x00) {
+          markDirty(page, x);
+        }
+      }
+    }
+    std::fill(buffer_.begin(), buffer_.end(), 0x00);
+  }
 
   void setPixel(int x, int y) {
-    printf("Setting pixel at x = %d, y = %d\n", x, y);
+    TRACE(SetPixel, x | y << 8);
     const auto [index, bit] = toIndex(x, y);
-    buffer_[index] |= 1 << bit;
+    const uint8_t value = buffer_[index] | (1 << bit);
+    if (value != buffer_[index]) {
+      buffer_[index] = value;
+      markDirty(y / kPageHeight, x);
+    }
   }
 
   void unsetPixel(int x, int y) {
     const auto [index, bit] = toIndex(x, y);
-    buffer_[index] &= ~(1 << bit);
+    const uint8_t value = buffer_[index] & ~(1 << bit);
+    if (value != buffer_[index]) {
+      buffer_[index] = value;
+      markDirty(y / kPageHeight, x);
+    }
   }
 
+  // Glyph columns are already in page-byte order (bit 0 on top), so each
+  // one is shifted into the page it starts on and the one below, clipped to
+  // the screen.
   void putLetter(int x, int y, char c) {
+    if (c < 32 || c - 32 >= static_cast<int>(kFont5x8.size())) {
+      return;
+    }
     const auto &glyph = kFont5x8[c - 32];
-    for (int w = 0; w < glyph.size(); ++w) {
-      for (int h = 0; h < 8; ++h) {
-        int bit = (glyph[w] >> h) & 1;
-        if (bit) {
-          setPixel(x + w, y + h);
-        }
+    // Rounded down, so glyphs partly above the screen clip correctly.
+    const int page = (y >= 0 ? y : y - kPageHeight + 1) / kPageHeight;
+    const int shift = y - page * kPageHeight;
+    for (int w = 0; w < static_cast<int>(glyph.size()); ++w) {
+      const int column = x + w;
+      if (column < 0 || column >= kWidth || glyph[w] == 0) {
+        continue;
+      }
+      blit(page, column, glyph[w] << shift);
+      if (shift != 0) {
+        blit(page + 1, column, glyph[w] >> (kPageHeight - shift));
       }
     }
   }
@@ -411,12 +1014,34 @@ private:
     return {index, bit};
   }
 
+  void blit(int page, int x, uint8_t bits) {
+    if (page < 0 || page >= kPages) {
+      return;
+    }
+    uint8_t &byte = buffer_[page * kWidth + x];
+    const uint8_t value = byte | bits;
+    if (value != byte) {
+      byte = value;
+      markDirty(page, x);
+    }
+  }
+
+  void markDirty(int page, int x) {
+    auto &range = dirty_[page];
+    range.first = std::min(range.first, x);
+    range.last = std::max(range.last, x);
+  }
+
 private:
   static constexpr int kWidth = 128;
   static constexpr int kHeight = 32;
   static constexpr int kPages = 4;
   static constexpr int kPageHeight = kHeight / kPages;
-  std::array<uint8_t, kWidth * kPages> buffer_;
+  std::array<uint8_t, kWidth * kPages> buffer_ = {};
+  std::array<ColumnRange, kPages> dirty_ = {{{0, kWidth - 1},
+                                             {0, kWidth - 1},
+                                             {0, kWidth - 1},
+                                             {0, kWidth - 1}}};
 };
 
 class SSD1906 {
@@ -447,38 +1072,439 @@ public:
         0xAF        // Display ON
     };
     i2c_write_blocking(i2c0, 0x3C, init_sequence, sizeof(init_sequence), false);
+    setupDma();
+  }
+
+  ~SSD1906() {
+    waitForIdle();
+    irq_remove_handler(DMA_IRQ_0, &SSD1906::onDmaIrq);
+    dma_channel_set_irq0_enabled(dmaChannel_, false);
+    dma_channel_unclaim(dmaChannel_);
+    instance_ = nullptr;
   }
 
+  // Resets the address window to the whole screen first: the display runs in
+  // horizontal addressing mode, and update() may have left a narrow one.
   void show(const Framebuffer &framebuffer) {
-    std::array<uint8_t, 129> buffer;
-    buffer[0] = 0x40;
-    for (uint8_t page = 0; page < 4; ++page) {
-      std::array<uint8_t, 4> pageAddress = {0x00, 0xB0 + page, 0x00, 0x10};
-      i2c_write_blocking(i2c0, 0x3C, pageAddress.data(), pageAddress.size(),
-                         false);
-      memcpy(buffer.data() + 1, &framebuffer.data()[page * 128], 128);
-      i2c_write_blocking(i2c0, 0x3C, buffer.data(), buffer.size(), false);
+    waitForIdle();
+    std::array<uint8_t, kMaxTransferBytes> buffer;
+    const size_t size = packWindow(framebuffer, kFullScreen, buffer.data());
+    i2c_write_blocking(i2c0, 0x3C, buffer.data(), size, false);
+    remember(framebuffer, kFullScreen);
+    countFrame(size);
+  }
+
+  // Sends the whole frame as one I2C transaction fed by DMA and returns right
+  // away. The framebuffer is copied, so the next frame can be drawn while
+  // this one is on the wire. Only blocks when a frame is already on the wire
+  // and another one is queued behind it.
+  void showAsync(const Framebuffer &framebuffer) {
+    remember(framebuffer, kFullScreen);
+    sendAsync(framebuffer, &kFullScreen, 1);
+  }
+
+  // Sends only what changed since the last update: the dirty columns of each
+  // page, trimmed against what the display already shows, each through its
+  // own column/page address window. Marks the framebuffer clean.
+  void update(Framebuffer &framebuffer) {
+    waitForIdle();
+    std::array<Window, Framebuffer::pages()> windows;
+    const int count = collectWindows(framebuffer, windows);
+    std::array<uint8_t, kMaxTransferBytes> buffer;
+    uint32_t bytes = 0;
+    for (int i = 0; i < count; ++i) {
+      const size_t size = packWindow(framebuffer, windows[i], buffer.data());
+      i2c_write_blocking(i2c0, 0x3C, buffer.data(), size, false);
+      bytes += size;
+    }
+    countFrame(bytes);
+  }
+
+  // Same as update(), but through DMA like showAsync().
+  void updateAsync(Framebuffer &framebuffer) {
+    std::array<Window, Framebuffer::pages()> windows;
+    const int count = collectWindows(framebuffer, windows);
+    sendAsync(framebuffer, windows.data(), count);
+  }
+
+  // DMA finishing only means the last byte is in the I2C TX FIFO. The frame
+  // has left once the FIFO is empty and the controller is no longer active;
+  // reprogramming the block before then would cut its tail off.
+  bool isBusy() const {
+    const uint32_t status = i2c_get_hw(i2c0)->status;
+    return busy_ || !(status & I2C_IC_STATUS_TFE_BITS) ||
+           (status & I2C_IC_STATUS_ACTIVITY_BITS);
+  }
+
+  void waitForIdle() const {
+    while (isBusy()) {
+      tight_loop_contents();
+    }
+  }
+
+  uint32_t framesSent() const { return framesSent_; }
+
+  // I2C payload bytes of the last show/update, and of all of them.
+  uint32_t bytesLastFrame() const { return bytesLastFrame_; }
+  uint64_t bytesSent() const { return bytesSent_; }
+
+private:
+  struct Window {
+    int firstColumn;
+    int lastColumn;
+    int firstPage;
+    int lastPage;
+  };
+
+  static constexpr Window kFullScreen = {0, Framebuffer::width() - 1, 0,
+                                         Framebuffer::pages() - 1};
+
+  // Every window is sent as one transaction: the column and page address
+  // commands, each behind a 0x80 control byte (Co = 1), then 0x40 and data.
+  static constexpr size_t kWindowHeaderSize = 13;
+  static constexpr size_t kMaxTransferBytes =
+      Framebuffer::pages() * kWindowHeaderSize + Framebuffer::size();
+
+  // DATA_CMD takes 16-bit writes: the data byte plus the STOP flag that ends
+  // the transaction after the last one.
+  using Transfer = std::array<uint16_t, kMaxTransferBytes>;
+
+  void setupDma() {
+    dmaChannel_ = dma_claim_unused_channel(true);
+    dma_channel_config config = dma_channel_get_default_config(dmaChannel_);
+    channel_config_set_transfer_data_size(&config, DMA_SIZE_16);
+    channel_config_set_read_increment(&config, true);
+    channel_config_set_write_increment(&config, false);
+    channel_config_set_dreq(&config, i2c_get_dreq(i2c0, true));
+    dma_channel_configure(dmaChannel_, &config, &i2c_get_hw(i2c0)->data_cmd,
+                          nullptr, 0, false);
+
+    // DMA writes DATA_CMD directly, so the target address has to be set up
+    // front. i2c_write_blocking sets the same one.
+    i2c_hw_t *hw = i2c_get_hw(i2c0);
+    hw->enable = 0;
+    hw->tar = 0x3C;
+    hw->enable = 1;
+
+    instance_ = this;
+    dma_channel_set_irq0_enabled(dmaChannel_, true);
+    irq_add_shared_handler(DMA_IRQ_0, &SSD1906::onDmaIrq,
+                           PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+    irq_set_enabled(DMA_IRQ_0, true);
+  }
+
+  int collectWindows(Framebuffer &framebuffer,
+                     std::array<Window, Framebuffer::pages()> &windows) {
+    constexpr int kWidth = Framebuffer::width();
+    const uint8_t *data = framebuffer.data();
+    int count = 0;
+    size_t perPageBytes = 0;
+    Window bounds = {kWidth, -1, Framebuffer::pages(), -1};
+    for (int page = 0; page < Framebuffer::pages(); ++page) {
+      auto [first, last] = framebuffer.dirtyColumns(page);
+      if (!shadowValid_) {
+        first = 0;
+        last = kWidth - 1;
+      } else {
+        const int offset = page * kWidth;
+        while (first <= last &&
+               data[offset + first] == shadow_[offset + first]) {
+          ++first;
+        }
+        while (last >= first &&
+               data[offset + last] == shadow_[offset + last]) {
+          --last;
+        }
+      }
+      if (first > last) {
+        continue;
+      }
+      windows[count++] = {first, last, page, page};
+      perPageBytes += kWindowHeaderSize + last - first + 1;
+      bounds = {std::min(bounds.firstColumn, first),
+                std::max(bounds.lastColumn, last),
+                std::min(bounds.firstPage, page), page};
+    }
+    framebuffer.markClean();
+
+    // A single rectangle over all dirty pages needs one header, but resends
+    // the clean bytes inside it. Take whichever is shorter on the wire.
+    if (count > 1) {
+      const size_t rectangleBytes =
+          kWindowHeaderSize + (bounds.lastColumn - bounds.firstColumn + 1) *
+                                  (bounds.lastPage - bounds.firstPage + 1);
+      if (rectangleBytes < perPageBytes) {
+        windows[0] = bounds;
+        count = 1;
+      }
+    }
+    for (int i = 0; i < count; ++i) {
+      remember(framebuffer, windows[i]);
+    }
+    return count;
+  }
+
+  // What the display RAM now holds, so the next update can skip it.
+  void remember(const Framebuffer &framebuffer, const Window &window) {
+    for (int page = window.firstPage; page <= window.lastPage; ++page) {
+      const int offset = page * Framebuffer::width();
+      std::copy(framebuffer.data() + offset + window.firstColumn,
+                framebuffer.data() + offset + window.lastColumn + 1,
+                shadow_.begin() + offset + window.firstColumn);
+    }
+    shadowValid_ = true;
+  }
+
+  template <typename T>
+  static size_t packWindow(const Framebuffer &framebuffer, const Window &window,
+                           T *out) {
+    const std::array<uint8_t, kWindowHeaderSize> header = {
+        0x80, 0x21, 0x80, static_cast<uint8_t>(window.firstColumn),
+        0x80, static_cast<uint8_t>(window.lastColumn),
+        0x80, 0x22, 0x80, static_cast<uint8_t>(window.firstPage),
+        0x80, static_cast<uint8_t>(window.lastPage),
+        0x40};
+    T *next = std::copy(header.begin(), header.end(), out);
+    for (int page = window.firstPage; page <= window.lastPage; ++page) {
+      const uint8_t *row = framebuffer.data() + page * Framebuffer::width();
+      next = std::copy(row + window.firstColumn, row + window.lastColumn + 1,
+                       next);
+    }
+    return next - out;
+  }
+
+  void sendAsync(const Framebuffer &framebuffer, const Window *windows,
+                 int count) {
+    while (pending_) {
+      tight_loop_contents();
+    }
+    const int next = 1 - active_;
+    auto &transfer = transfers_[next];
+    size_t size = 0;
+    for (int i = 0; i < count; ++i) {
+      size += packWindow(framebuffer, windows[i], transfer.data() + size);
+      transfer[size - 1] |= I2C_IC_DATA_CMD_STOP_BITS;
+    }
+    countFrame(size);
+    if (size == 0) {
+      return;
+    }
+    transferSizes_[next] = size;
+    const uint32_t status = save_and_disable_interrupts();
+    if (busy_) {
+      pending_ = true;
+    } else {
+      startTransfer(next);
     }
+    restore_interrupts(status);
   }
+
+  void countFrame(uint32_t bytes) {
+    bytesLastFrame_ = bytes;
+    bytesSent_ += bytes;
+  }
+
+  void startTransfer(int index) {
+    active_ = index;
+    busy_ = true;
+    dma_channel_transfer_from_buffer_now(dmaChannel_, transfers_[index].data(),
+                                         transferSizes_[index]);
+  }
+
+  static void onDmaIrq() {
+    if (instance_ == nullptr ||
+        !dma_channel_get_irq0_status(instance_->dmaChannel_)) {
+      return;
+    }
+    dma_channel_acknowledge_irq0(instance_->dmaChannel_);
+    instance_->onTransferDone();
+  }
+
+  void onTransferDone() {
+    ++framesSent_;
+    if (pending_) {
+      pending_ = false;
+      startTransfer(1 - active_);
+    } else {
+      busy_ = false;
+    }
+  }
+
+private:
+  static inline SSD1906 *instance_ = nullptr;
+  uint dmaChannel_;
+  std::array<Transfer, 2> transfers_;
+  std::array<size_t, 2> transferSizes_ = {};
+  volatile int active_ = 0;
+  volatile bool busy_ = false;
+  volatile bool pending_ = false;
+  volatile uint32_t framesSent_ = 0;
+  std::array<uint8_t, Framebuffer::size()> shadow_;
+  bool shadowValid_ = false;
+  uint32_t bytesLastFrame_ = 0;
+  uint64_t bytesSent_ = 0;
 };
 
+#ifdef BENCHMARK
+// Sends frames back to back, with |drawUs| of busy work standing in for
+// drawing each one, and reports how much of the time the CPU was stuck in
+// the display code.
+void benchmarkShow(SSD1906 &oled, Framebuffer &framebuffer, bool async,
+                   uint32_t drawUs) {
+  constexpr int kFrames = 100;
+  uint64_t blockedUs = 0;
+  const uint64_t startUs = time_us_64();
+  for (int frame = 0; frame < kFrames; ++frame) {
+    framebuffer.clear();
+    busy_wait_us(drawUs);
+    const uint64_t showStartUs = time_us_64();
+    if (async) {
+      oled.showAsync(framebuffer);
+    } else {
+      oled.show(framebuffer);
+    }
+    blockedUs += time_us_64() - showStartUs;
+  }
+  oled.waitForIdle();
+  const uint64_t elapsedUs = time_us_64() - startUs;
+  printf("%-8s draw %5u us: %6.1f frames/s, CPU busy in show %5.1f%%\n",
+         async ? "async" : "blocking", static_cast<unsigned>(drawUs),
+         kFrames * 1e6 / elapsedUs, 100.0 * blockedUs / elapsedUs);
+}
+
+// A thermometer-like dashboard where only a digit or two changes between
+// frames: how many bytes a full redraw and a partial update put on the bus.
+void benchmarkDashboard(SSD1906 &oled, Framebuffer &framebuffer, bool partial) {
+  constexpr int kFrames = 50;
+  const uint64_t bytesBefore = oled.bytesSent();
+  const uint64_t startUs = time_us_64();
+  for (int frame = 0; frame < kFrames; ++frame) {
+    framebuffer.clear();
+    framebuffer.putText(0, 0, "ROOM");
+    framebuffer.putText(0, 12, "TEMP: " + std::to_string(2150 + frame) +
+                                   " C");
+    if (partial) {
+      oled.update(framebuffer);
+    } else {
+      oled.show(framebuffer);
+    }
+  }
+  const uint64_t elapsedUs = time_us_64() - startUs;
+  printf("%-8s %6.1f bytes/frame, %6.1f frames/s\n",
+         partial ? "partial" : "full",
+         double(oled.bytesSent() - bytesBefore) / kFrames,
+         kFrames * 1e6 / elapsedUs);
+}
+
+// Text rendering the way putLetter used to do it, one setPixel per bit.
+void putTextByPixel(Framebuffer &framebuffer, int x, int y,
+                    const std::string &text) {
+  for (int i = 0; i < text.size(); ++i) {
+    const auto &glyph = kFont5x8[std::toupper(text[i]) - 32];
+    for (int w = 0; w < glyph.size(); ++w) {
+      for (int h = 0; h < 8; ++h) {
+        if ((glyph[w] >> h) & 1) {
+          framebuffer.setPixel(x + i * 7 + w, y + h);
+        }
+      }
+    }
+  }
+}
+
+// Characters per second drawn into the framebuffer, at a page-aligned and an
+// unaligned y. On the host run it with PICO_HOST_CLOCK=hybrid, otherwise
+// pure computation takes no time.
+void benchmarkText(Framebuffer &framebuffer, bool byPixel) {
+  constexpr int kRepeats = 200;
+  const std::string text = "TEMP: 21.50 C";
+  for (int y : {8, 11}) {
+    const uint64_t startUs = time_us_64();
+    for (int i = 0; i < kRepeats; ++i) {
+      framebuffer.clear();
+      if (byPixel) {
+        putTextByPixel(framebuffer, 0, y, text);
+      } else {
+        framebuffer.putText(0, y, text);
+      }
+    }
+    const uint64_t elapsedUs = std::max<uint64_t>(time_us_64() - startUs, 1);
+    printf("%-8s y = %2d: %10.0f chars/s\n", byPixel ? "setPixel" : "blit", y,
+           kRepeats * text.size() * 1e6 / elapsedUs);
+  }
+}
+
+int main() {
+  stdio_init_all();
+
+  SSD1906 oled(16, 17);
+  sleep_ms(5000);
+
+  Framebuffer framebuffer;
+
+  for (uint32_t drawUs : {0, 5000, 12000}) {
+    benchmarkShow(oled, framebuffer, false, drawUs);
+    benchmarkShow(oled, framebuffer, true, drawUs);
+  }
+
+  benchmarkDashboard(oled, framebuffer, false);
+  benchmarkDashboard(oled, framebuffer, true);
+
+  benchmarkText(framebuffer, true);
+  benchmarkText(framebuffer, false);
+
+  return 0;
+}
+#else
 int main() {
   stdio_init_all();
 
-  DS18B20 sensor(26);
+  DS18B20 sensors(26);
   SSD1906 oled(16, 17);
   sleep_ms(5000);
 
   Framebuffer framebuffer;
 
+  // The display keeps refreshing while the sensors convert; new readings
+  // replace the text whenever they are ready. One line per sensor, up to
+  // four; a single sensor stays centred.
+  std::array<std::string, 4> lines = {"Temp: ..."};
+  sensors.searchSensors();
+  sensors.startConversion();
+  FrameClock clock(100000);
   while (1) {
+    clock.waitForFrame();
+    if (sensors.conversionDone()) {
+      if (sensors.numSensors() == 0) {
+        sensors.searchSensors();
+      }
+      for (size_t i = 0; i < lines.size(); ++i) {
+        float celsius;
+        if (i >= sensors.numSensors()) {
+          lines[i] = i == 0 ? "Sensor: no device" : "";
+          continue;
+        }
+        const auto status = sensors.readResult(i, celsius);
+        if (status == DS18B20::Status::Ok) {
+          lines[i] = "Temp: " + std::to_string(celsius) + " C";
+        } else {
+          lines[i] = std::string("Sensor: ") + DS18B20::describe(status);
+        }
+      }
+      sensors.startConversion();
+    }
     framebuffer.clear();
-    std::string output =
-        "Temp: " + std::to_string(*sensor.getTemperature()) + " C";
-    framebuffer.putText(0, 12, output);
-    oled.show(framebuffer);
-    sleep_ms(1000);
+    if (sensors.numSensors() <= 1) {
+      framebuffer.putText(0, 12, lines[0]);
+    } else {
+      for (size_t i = 0; i < lines.size(); ++i) {
+        framebuffer.putText(0, 8 * i, lines[i]);
+      }
+    }
+    oled.updateAsync(framebuffer);
+    clock.frameDone();
+    drainTrace();
   }
 
   return 0;
 }
+#endif
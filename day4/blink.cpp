@@ -1,9 +1,13 @@
+#include <algorithm>
+#include <array>
+#include <cmath>
 #include <cstdio>
 #include <initializer_list>
 
 #include "pico/stdlib.h"
 #include "hardware/adc.h"
 #include "hardware/gpio.h"
+#include "hardware/sync.h"
 
 class Led {
 public:
@@ -34,30 +38,146 @@ private:
   const int pin_;
 };
 
+// Single producer, single consumer: an IRQ pushes and the main loop pops.
+// Each side only writes its own index, so neither has to mask interrupts,
+// and a full queue drops the new event rather than stall the IRQ. The
+// barrier publishes the item before the index that makes it visible.
+template <typename T, size_t N> class EventQueue {
+  static_assert((N & (N - 1)) == 0, "N must be a power of two");
+
+public:
+  bool push(const T &item) {
+    const uint32_t head = head_;
+    if (head - tail_ == N) {
+      dropped_ = dropped_ + 1;
+      return false;
+    }
+    items_[head % N] = item;
+    __dmb();
+    head_ = head + 1;
+    return true;
+  }
+
+  bool pop(T &item) {
+    const uint32_t tail = tail_;
+    if (tail == head_) {
+      return false;
+    }
+    item = items_[tail % N];
+    __dmb();
+    tail_ = tail + 1;
+    return true;
+  }
+
+  uint32_t dropped() const { return dropped_; }
+
+private:
+  std::array<T, N> items_ = {};
+  volatile uint32_t head_ = 0;
+  volatile uint32_t tail_ = 0;
+  volatile uint32_t dropped_ = 0;
+};
+
+// Edges come from the GPIO IRQ, stamped with time_us_64() as it runs, so no
+// press is missed however long the main loop is busy. The first edge counts
+// at once; the contacts then get debounceUs to settle before the pin is read
+// again, which catches a release that happened during the bounce.
 class Button {
 public:
-  explicit Button(int pin): pin_(pin) {
+  enum class EventType { PRESS, RELEASE };
+
+  struct Event {
+    EventType type;
+    uint64_t timeUs;
+  };
+
+  static constexpr uint32_t kDefaultDebounceUs = 5000;
+
+  explicit Button(int pin, uint32_t debounceUs = kDefaultDebounceUs)
+      : pin_(pin), debounceUs_(debounceUs) {
     gpio_init(pin_);
     gpio_set_dir(pin_, GPIO_IN);
     gpio_pull_down(pin_);
+    pressed_ = gpio_get(pin_);
+    buttons_[pin_] = this;
+    gpio_set_irq_enabled_with_callback(pin_, kEdges, true, &Button::onGpioIrq);
   }
 
+  ~Button() {
+    gpio_set_irq_enabled(pin_, kEdges, false);
+    if (settleAlarm_ != 0) {
+      cancel_alarm(settleAlarm_);
+    }
+    buttons_[pin_] = nullptr;
+  }
+
+  Button(const Button &) = delete;
+  Button &operator=(const Button &) = delete;
+
+  // Whether the button was pressed since the last call, however briefly.
   bool is_pressed() {
-    bool state = gpio_get(pin_);
-    if (state) {
-      if (!is_pressed_) {
-        is_pressed_ = true;
-        return true;
-      }
-    } else {
-      is_pressed_ = false;
+    bool pressed = false;
+    Event event;
+    while (events_.pop(event)) {
+      pressed = pressed || event.type == EventType::PRESS;
     }
-    return false;
+    return pressed;
   }
 
+  // Presses and releases in order, for callers that need both or the time.
+  bool nextEvent(Event &event) { return events_.pop(event); }
+
+  uint32_t droppedEvents() const { return events_.dropped(); }
+
 private:
-  int pin_;
-  bool is_pressed_ = {};
+  static constexpr uint32_t kEdges = GPIO_IRQ_EDGE_RISE | GPIO_IRQ_EDGE_FALL;
+
+  // The SDK has a single GPIO callback for all pins.
+  static void onGpioIrq(uint gpio, uint32_t events) {
+    if (Button *button = buttons_[gpio]) {
+      button->onEdge(time_us_64());
+    }
+  }
+
+  void onEdge(uint64_t timeUs) {
+    lastEdgeUs_ = timeUs;
+    if (settleAlarm_ == 0 && update(timeUs)) {
+      settleAlarm_ =
+          add_alarm_in_us(debounceUs_, &Button::onSettled, this, true);
+    }
+  }
+
+  // Queues the level the pin is at now, if that is news.
+  bool update(uint64_t timeUs) {
+    const bool level = gpio_get(pin_);
+    if (level == pressed_) {
+      return false;
+    }
+    pressed_ = level;
+    events_.push({level ? EventType::PRESS : EventType::RELEASE, timeUs});
+    return true;
+  }
+
+  static int64_t onSettled(alarm_id_t, void *userData) {
+    auto *button = static_cast<Button *>(userData);
+    // It changed again while bouncing: that counts from its last edge, and
+    // gets its own time to settle.
+    if (button->update(button->lastEdgeUs_)) {
+      return button->debounceUs_;
+    }
+    button->settleAlarm_ = 0;
+    return 0;
+  }
+
+private:
+  static inline std::array<Button *, NUM_BANK0_GPIOS> buttons_ = {};
+  const int pin_;
+  const uint32_t debounceUs_;
+
+  bool pressed_ = false;
+  volatile alarm_id_t settleAlarm_ = 0;
+  volatile uint64_t lastEdgeUs_ = 0;
+  EventQueue<Event, 16> events_;
 };
 
 class Knob {
@@ -83,16 +203,291 @@ enum class Subdivision {
   TRIPPLETS
 };
 
+// Keeps time from alarm callbacks, so the beat never waits for the main
+// loop. Every pulse edge has an absolute due time worked out from where the
+// current tempo started, never from the previous edge, so neither rounding
+// nor IRQ latency adds up. Tempo and subdivision changes take effect on the
+// next beat. The handler runs in the timer IRQ; how late each edge ran is
+// measured there.
+class Metronome {
+public:
+  static constexpr int kBeatsPerBar = 4;
+
+  // Each subdivision of a beat is one pulse: on for its first half, off for
+  // the second.
+  struct Pulse {
+    int beat; // within the bar
+    int subdivision;
+    bool on;
+  };
+
+  using PulseHandler = void (*)(const Pulse &pulse, void *userData);
+
+  struct TimingError {
+    uint32_t edges;
+    uint32_t meanLateUs;
+    uint32_t maxLateUs;
+  };
+
+  Metronome(uint32_t milliBpm, int subdivisions, PulseHandler handler,
+            void *userData)
+      : handler_(handler), userData_(userData), milliBpm_(milliBpm),
+        subdivisions_(subdivisions), pendingMilliBpm_(milliBpm),
+        pendingSubdivisions_(subdivisions) {}
+
+  ~Metronome() { stop(); }
+
+  Metronome(const Metronome &) = delete;
+  Metronome &operator=(const Metronome &) = delete;
+
+  void start() {
+    stop();
+    const uint32_t status = save_and_disable_interrupts();
+    beat_ = 0;
+    subdivision_ = 0;
+    on_ = true;
+    beatInTempo_ = 0;
+    tempoStartUs_ = time_us_64() + kStartDelayUs;
+    dueUs_ = tempoStartUs_;
+    alarm_ = add_alarm_at(from_us_since_boot(dueUs_), &Metronome::onAlarm,
+                          this, true);
+    restore_interrupts(status);
+  }
+
+  void stop() {
+    if (alarm_ != 0) {
+      cancel_alarm(alarm_);
+      alarm_ = 0;
+    }
+  }
+
+  void setTempo(uint32_t milliBpm) { pendingMilliBpm_ = milliBpm; }
+  void setSubdivisions(int subdivisions) {
+    pendingSubdivisions_ = subdivisions;
+  }
+
+  uint32_t milliBpm() const { return milliBpm_; }
+  int subdivisions() const { return subdivisions_; }
+
+  TimingError timingError() const {
+    const uint32_t status = save_and_disable_interrupts();
+    const TimingError error = {
+        edges_, edges_ == 0 ? 0 : uint32_t(lateSumUs_ / edges_), maxLateUs_};
+    restore_interrupts(status);
+    return error;
+  }
+
+  void resetTimingError() {
+    const uint32_t status = save_and_disable_interrupts();
+    edges_ = 0;
+    lateSumUs_ = 0;
+    maxLateUs_ = 0;
+    restore_interrupts(status);
+  }
+
+private:
+  // Room for the first edge to be set up before it is due.
+  static constexpr uint64_t kStartDelayUs = 1000;
+
+  // Start of beat |n| counted from where the current tempo started.
+  uint64_t beatStartUs(uint64_t n) const {
+    return tempoStartUs_ + n * 60'000'000'000ull / milliBpm_;
+  }
+
+  uint64_t pulseStartUs(uint64_t n, int subdivision) const {
+    const uint64_t beatUs = beatStartUs(n + 1) - beatStartUs(n);
+    return beatStartUs(n) + beatUs * subdivision / subdivisions_;
+  }
+
+  // Due time of the edge we are at now.
+  uint64_t edgeUs() const {
+    const uint64_t startUs = pulseStartUs(beatInTempo_, subdivision_);
+    if (on_) {
+      return startUs;
+    }
+    const uint64_t endUs = subdivision_ + 1 == subdivisions_
+                               ? beatStartUs(beatInTempo_ + 1)
+                               : pulseStartUs(beatInTempo_, subdivision_ + 1);
+    return startUs + (endUs - startUs) / 2;
+  }
+
+  void nextEdge() {
+    if (on_) {
+      on_ = false;
+      return;
+    }
+    on_ = true;
+    if (++subdivision_ < subdivisions_) {
+      return;
+    }
+    subdivision_ = 0;
+    beat_ = (beat_ + 1) % kBeatsPerBar;
+    ++beatInTempo_;
+    if (pendingMilliBpm_ != milliBpm_ ||
+        pendingSubdivisions_ != subdivisions_) {
+      // The new tempo counts from this beat.
+      tempoStartUs_ = beatStartUs(beatInTempo_);
+      beatInTempo_ = 0;
+      milliBpm_ = std::max<uint32_t>(uint32_t(pendingMilliBpm_), 1);
+      subdivisions_ = std::max(int(pendingSubdivisions_), 1);
+    }
+  }
+
+  static int64_t onAlarm(alarm_id_t, void *userData) {
+    return static_cast<Metronome *>(userData)->onEdge();
+  }
+
+  int64_t onEdge() {
+    const uint64_t lateUs = time_us_64() - dueUs_;
+    ++edges_;
+    lateSumUs_ += lateUs;
+    maxLateUs_ = std::max<uint32_t>(maxLateUs_, lateUs);
+
+    handler_({beat_, subdivision_, on_}, userData_);
+    const uint64_t previousUs = dueUs_;
+    nextEdge();
+    dueUs_ = edgeUs();
+    // Negative: counted from when this alarm was due, not from now.
+    return -std::max<int64_t>(dueUs_ - previousUs, 1);
+  }
+
+private:
+  const PulseHandler handler_;
+  void *const userData_;
+
+  uint32_t milliBpm_;
+  int subdivisions_;
+  volatile uint32_t pendingMilliBpm_;
+  volatile int pendingSubdivisions_;
+
+  alarm_id_t alarm_ = 0;
+  uint64_t tempoStartUs_ = 0;
+  uint64_t beatInTempo_ = 0;
+  int beat_ = 0;
+  int subdivision_ = 0;
+  bool on_ = true;
+  uint64_t dueUs_ = 0;
+
+  uint32_t edges_ = 0;
+  uint64_t lateSumUs_ = 0;
+  uint32_t maxLateUs_ = 0;
+};
+
+using Leds = std::array<Led, Metronome::kBeatsPerBar>;
+
+// One LED per beat of the bar, lit for the first half of every pulse.
+void showPulse(const Metronome::Pulse& pulse, void* userData) {
+  const auto& leds = *static_cast<Leds*>(userData);
+  if (pulse.on) {
+    leds[pulse.beat].turnOn();
+  } else {
+    leds[pulse.beat].turnOff();
+  }
+}
+
+#ifdef BENCHMARK
+// How long after the previous pulse each pulse of one run started, from
+// timestamps taken in the alarm callback right after the outputs changed.
+// Intervals fit in 32 bits however long the run goes on.
+struct EdgeLog {
+  static constexpr int kMaxEdges = 9000;
+
+  Metronome::PulseHandler outputs;
+  void* outputsData;
+  std::array<uint32_t, kMaxEdges> intervalsUs;
+  uint64_t lastUs;
+  int expected;
+  volatile int count;
+};
+
+void logPulse(const Metronome::Pulse& pulse, void* userData) {
+  auto& log = *static_cast<EdgeLog*>(userData);
+  log.outputs(pulse, log.outputsData);
+  if (pulse.on && log.count < log.expected) {
+    const uint64_t nowUs = time_us_64();
+    log.intervalsUs[log.count] =
+        log.count == 0 ? 0 : static_cast<uint32_t>(nowUs - log.lastUs);
+    log.lastUs = nowUs;
+    log.count = log.count + 1;
+  }
+}
+
+// Plays |kBeats| beats and compares every pulse with an ideal grid that
+// starts at the first one: the mean drift of a pulse interval, the 99th
+// percentile of how far an interval strays from the ideal, where the last
+// pulse ended up (the cumulative error) and the furthest any pulse got.
+void benchmarkTiming(EdgeLog& log, uint32_t bpm, Subdivision mode) {
+  constexpr int kBeats = 3000;
+  static_assert(kBeats * static_cast<int>(Subdivision::TRIPPLETS) <=
+                    EdgeLog::kMaxEdges,
+                "the log holds every pulse of the longest run");
+
+  const int subdivisions = static_cast<int>(mode);
+  const int edges = kBeats * subdivisions;
+  log.expected = edges;
+  log.count = 0;
+  Metronome metronome(1000 * bpm, subdivisions, logPulse, &log);
+  metronome.start();
+  while (log.count < edges) {
+    __wfe();
+  }
+  metronome.stop();
+  for (int beat = 0; beat < Metronome::kBeatsPerBar; ++beat) {
+    log.outputs({beat, 0, false}, log.outputsData);
+  }
+
+  // The elapsed time adds up exactly in whole microseconds. Each interval is
+  // then replaced by its jitter in nanoseconds, for the percentile.
+  const double periodUs = 60e6 / bpm / subdivisions;
+  uint64_t elapsedUs = 0;
+  double worstUs = 0;
+  for (int i = 1; i < edges; ++i) {
+    const uint32_t intervalUs = log.intervalsUs[i];
+    elapsedUs += intervalUs;
+    worstUs = std::max(worstUs, std::fabs(elapsedUs - i * periodUs));
+    log.intervalsUs[i] =
+        static_cast<uint32_t>(std::fabs(intervalUs - periodUs) * 1000 + 0.5);
+  }
+  const double cumulativeUs = elapsedUs - (edges - 1) * periodUs;
+  const auto jitterNs = log.intervalsUs.begin() + 1;
+  const auto p99 = jitterNs + (edges - 1) * 99 / 100;
+  std::nth_element(jitterNs, p99, jitterNs + edges - 1);
+
+  printf("%3u bpm x%d: %4d pulses, drift %+7.3f us/pulse, p99 jitter %6.1f "
+         "us, cumulative %+8.1f us, worst %6.1f us\n",
+         unsigned(bpm), subdivisions, edges, cumulativeUs / (edges - 1),
+         *p99 / 1000.0, cumulativeUs, worstUs);
+}
+
+// Sweeps the tempo range in every subdivision; it keeps real time, so this
+// takes about ten hours. On the host, set PICO_HOST_RUN_MS=0 to let it finish,
+// and PICO_HOST_CLOCK=hybrid to have host scheduling show up as jitter.
+int main() {
+  stdio_init_all();
+
+  static EdgeLog log;
+  Leds leds = {Led(25), Led(21), Led(20), Led(19)};
+  log.outputs = showPulse;
+  log.outputsData = &leds;
+  sleep_ms(5000);
+
+  for (uint32_t bpm : {40, 70, 100, 150, 200, 250}) {
+    for (auto mode : {Subdivision::QUARTERS, Subdivision::EIGHTHS,
+                      Subdivision::TRIPPLETS}) {
+      benchmarkTiming(log, bpm, mode);
+    }
+  }
+
+  return 0;
+}
+#else
 int main() {
   constexpr float maxBpm = 250;
   constexpr float minBpm = 40;
 
   stdio_init_all();
 
-  Led led0(25);
-  Led led1(21);
-  Led led2(20);
-  Led led3(19);
+  Leds leds = {Led(25), Led(21), Led(20), Led(19)};
 
   Button b1(2);
   Button b2(3);
@@ -102,6 +497,11 @@ int main() {
 
   auto mode = Subdivision::QUARTERS;
 
+  Metronome metronome(1000 * minBpm, static_cast<int>(mode), showPulse, &leds);
+  metronome.start();
+
+  // The metronome keeps time on its own; this loop only passes on changes.
+  uint32_t loops = 0;
   while (1) {
     if (b1.is_pressed()) {
       mode = Subdivision::QUARTERS;
@@ -114,20 +514,20 @@ int main() {
     }
 
     const float bpm = (maxBpm - minBpm) * knob.read() + minBpm;
+    metronome.setTempo(1000 * static_cast<uint32_t>(bpm + 0.5f));
+    metronome.setSubdivisions(static_cast<int>(mode));
 
-    int repeats = static_cast<int>(mode);
-    printf("mode = %d\n", repeats);
-    printf("bpm = %f\n", bpm);
-
-    const float duration = 1000 * (60 / (bpm * repeats)); // in ms
-
-    for (const auto& led : {led0, led1, led2, led3}) {
-      for (int r = 0; r < repeats; ++r) {
-        led.turnOnFor(duration / 2);
-        sleep_ms(duration / 2);
-      }
+    if (++loops % 250 == 0) {
+      const auto error = metronome.timingError();
+      printf("mode = %d, bpm = %u\n", metronome.subdivisions(),
+             unsigned(metronome.milliBpm() / 1000));
+      printf("%u edges, late by %u us on average, %u us at most\n",
+             unsigned(error.edges), unsigned(error.meanLateUs),
+             unsigned(error.maxLateUs));
     }
+    sleep_ms(20);
   }
 
   return 0;
 }
+#endif
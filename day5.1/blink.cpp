@@ -1,5 +1,7 @@
+#include <algorithm>
 #include <array>
 
+#include <cmath>
 #include <cstdint>
 #include <cstdio>
 
@@ -10,8 +12,12 @@
 
 #include "hardware/adc.h"
 #include "hardware/clocks.h"
+#include "hardware/dma.h"
 #include "hardware/gpio.h"
+#include "hardware/irq.h"
 #include "hardware/pwm.h"
+#include "hardware/sync.h"
+#include "pico/multicore.h"
 #include "pico/stdlib.h"
 
 class Led {
@@ -37,30 +43,146 @@ private:
   const int pin_;
 };
 
+// Single producer, single consumer: an IRQ pushes and the main loop pops.
+// Each side only writes its own index, so neither has to mask interrupts,
+// and a full queue drops the new event rather than stall the IRQ. The
+// barrier publishes the item before the index that makes it visible.
+template <typename T, size_t N> class EventQueue {
+  static_assert((N & (N - 1)) == 0, "N must be a power of two");
+
+public:
+  bool push(const T &item) {
+    const uint32_t head = head_;
+    if (head - tail_ == N) {
+      dropped_ = dropped_ + 1;
+      return false;
+    }
+    items_[head % N] = item;
+    __dmb();
+    head_ = head + 1;
+    return true;
+  }
+
+  bool pop(T &item) {
+    const uint32_t tail = tail_;
+    if (tail == head_) {
+      return false;
+    }
+    item = items_[tail % N];
+    __dmb();
+    tail_ = tail + 1;
+    return true;
+  }
+
+  uint32_t dropped() const { return dropped_; }
+
+private:
+  std::array<T, N> items_ = {};
+  volatile uint32_t head_ = 0;
+  volatile uint32_t tail_ = 0;
+  volatile uint32_t dropped_ = 0;
+};
+
+// Edges come from the GPIO IRQ, stamped with time_us_64() as it runs, so no
+// press is missed however long the main loop is busy. The first edge counts
+// at once; the contacts then get debounceUs to settle before the pin is read
+// again, which catches a release that happened during the bounce.
 class Button {
 public:
-  explicit Button(int pin) : pin_(pin) {
+  enum class EventType { PRESS, RELEASE };
+
+  struct Event {
+    EventType type;
+    uint64_t timeUs;
+  };
+
+  static constexpr uint32_t kDefaultDebounceUs = 5000;
+
+  explicit Button(int pin, uint32_t debounceUs = kDefaultDebounceUs)
+      : pin_(pin), debounceUs_(debounceUs) {
     gpio_init(pin_);
     gpio_set_dir(pin_, GPIO_IN);
     gpio_pull_down(pin_);
+    pressed_ = gpio_get(pin_);
+    buttons_[pin_] = this;
+    gpio_set_irq_enabled_with_callback(pin_, kEdges, true, &Button::onGpioIrq);
   }
 
+  ~Button() {
+    gpio_set_irq_enabled(pin_, kEdges, false);
+    if (settleAlarm_ != 0) {
+      cancel_alarm(settleAlarm_);
+    }
+    buttons_[pin_] = nullptr;
+  }
+
+  Button(const Button &) = delete;
+  Button &operator=(const Button &) = delete;
+
+  // Whether the button was pressed since the last call, however briefly.
   bool is_pressed() {
-    bool state = gpio_get(pin_);
-    if (state) {
-      if (!is_pressed_) {
-        is_pressed_ = true;
-        return true;
-      }
-    } else {
-      is_pressed_ = false;
+    bool pressed = false;
+    Event event;
+    while (events_.pop(event)) {
+      pressed = pressed || event.type == EventType::PRESS;
     }
-    return false;
+    return pressed;
   }
 
+  // Presses and releases in order, for callers that need both or the time.
+  bool nextEvent(Event &event) { return events_.pop(event); }
+
+  uint32_t droppedEvents() const { return events_.dropped(); }
+
 private:
-  int pin_;
-  bool is_pressed_ = {};
+  static constexpr uint32_t kEdges = GPIO_IRQ_EDGE_RISE | GPIO_IRQ_EDGE_FALL;
+
+  // The SDK has a single GPIO callback for all pins.
+  static void onGpioIrq(uint gpio, uint32_t events) {
+    if (Button *button = buttons_[gpio]) {
+      button->onEdge(time_us_64());
+    }
+  }
+
+  void onEdge(uint64_t timeUs) {
+    lastEdgeUs_ = timeUs;
+    if (settleAlarm_ == 0 && update(timeUs)) {
+      settleAlarm_ =
+          add_alarm_in_us(debounceUs_, &Button::onSettled, this, true);
+    }
+  }
+
+  // Queues the level the pin is at now, if that is news.
+  bool update(uint64_t timeUs) {
+    const bool level = gpio_get(pin_);
+    if (level == pressed_) {
+      return false;
+    }
+    pressed_ = level;
+    events_.push({level ? EventType::PRESS : EventType::RELEASE, timeUs});
+    return true;
+  }
+
+  static int64_t onSettled(alarm_id_t, void *userData) {
+    auto *button = static_cast<Button *>(userData);
+    // It changed again while bouncing: that counts from its last edge, and
+    // gets its own time to settle.
+    if (button->update(button->lastEdgeUs_)) {
+      return button->debounceUs_;
+    }
+    button->settleAlarm_ = 0;
+    return 0;
+  }
+
+private:
+  static inline std::array<Button *, NUM_BANK0_GPIOS> buttons_ = {};
+  const int pin_;
+  const uint32_t debounceUs_;
+
+  bool pressed_ = false;
+  volatile alarm_id_t settleAlarm_ = 0;
+  volatile uint64_t lastEdgeUs_ = 0;
+  EventQueue<Event, 16> events_;
 };
 
 class Knob {
@@ -82,8 +204,107 @@ private:
 
 enum class Subdivision { QUARTERS = 1, EIGHTHS, TRIPPLETS };
 
+// The clock the note table below is worked out for.
+#if defined(SYS_CLK_HZ)
+constexpr uint32_t kNoteClockHz = SYS_CLK_HZ;
+#elif defined(SYS_CLK_KHZ)
+constexpr uint32_t kNoteClockHz = SYS_CLK_KHZ * 1000;
+#else
+constexpr uint32_t kNoteClockHz = 125'000'000;
+#endif
+
+// Equal temperament around A4 = MIDI note 69 = 440 Hz.
+constexpr double midiFrequency(int note) {
+  constexpr double kSemitone = 1.0594630943592953; // 2^(1/12)
+  double frequency = 440.0;
+  for (int n = 69; n < note; ++n) {
+    frequency *= kSemitone;
+  }
+  for (int n = 69; n > note; --n) {
+    frequency /= kSemitone;
+  }
+  return frequency;
+}
+
+// How the PWM slice plays one note: the divider in 8.4 fixed point, as the
+// DIV register takes it, and the wrap.
+struct NoteSetting {
+  uint16_t divider16;
+  uint16_t wrap;
+};
+
+constexpr double settingFrequency(const NoteSetting &setting) {
+  return 16.0 * kNoteClockHz / (setting.divider16 * (setting.wrap + 1.0));
+}
+
+// Starts from the smallest divider whose wrap fits in 16 bits and tries the
+// next few dozen: larger ones only coarsen the wrap, but one of them may
+// divide the clock more evenly. On a tie the smaller divider wins, for the
+// finer duty cycle.
+constexpr NoteSetting bestSetting(double frequency) {
+  constexpr uint32_t kCandidates = 64;
+  const double minDivider16 = 16.0 * kNoteClockHz / (frequency * 0x10000);
+  const uint32_t first = std::max<uint32_t>(uint32_t(minDivider16) + 1, 16);
+  NoteSetting best = {0xFFF, 0xFFFF};
+  double bestError = 1e9;
+  for (uint32_t divider16 = first;
+       divider16 < first + kCandidates && divider16 <= 0xFFF; ++divider16) {
+    const double ticks = 16.0 * kNoteClockHz / (divider16 * frequency);
+    const uint32_t period = std::max<uint32_t>(uint32_t(ticks + 0.5), 2);
+    if (period > 0x10000) {
+      continue;
+    }
+    const NoteSetting setting = {uint16_t(divider16), uint16_t(period - 1)};
+    const double error = settingFrequency(setting) - frequency;
+    if ((error < 0 ? -error : error) < bestError) {
+      bestError = error < 0 ? -error : error;
+      best = setting;
+    }
+  }
+  return best;
+}
+
+constexpr std::array<NoteSetting, 128> makeNoteTable() {
+  std::array<NoteSetting, 128> table = {};
+  for (int note = 0; note < 128; ++note) {
+    table[note] = bestSetting(midiFrequency(note));
+  }
+  return table;
+}
+
+constexpr std::array<NoteSetting, 128> kNoteTable = makeNoteTable();
+
+constexpr std::array<uint32_t, 128> makeNoteMillihertz() {
+  std::array<uint32_t, 128> table = {};
+  for (int note = 0; note < 128; ++note) {
+    table[note] = uint32_t(midiFrequency(note) * 1000 + 0.5);
+  }
+  return table;
+}
+
+// For the synth, which takes frequencies in millihertz.
+constexpr std::array<uint32_t, 128> kNoteMillihertz = makeNoteMillihertz();
+
+// How far each note of the table is off, in cents (1/100 of a semitone).
+void printNoteTable() {
+  double worstCents = 0;
+  for (int note = 0; note < 128; ++note) {
+    const NoteSetting &setting = kNoteTable[note];
+    const double target = midiFrequency(note);
+    const double cents = 1200 * std::log2(settingFrequency(setting) / target);
+    printf("note %3d %9.3f Hz: div %3u.%02u wrap %5u, %+.4f cents\n", note,
+           target, setting.divider16 >> 4, setting.divider16 & 15,
+           setting.wrap, cents);
+    worstCents = std::max(worstCents, std::abs(cents));
+  }
+  printf("worst note error: %.4f cents\n", worstCents);
+}
+
 class Buzzer {
 public:
+  // Fills |count| signed samples for sample playback. Runs in the DMA IRQ.
+  using AudioSource = void (*)(int16_t *samples, size_t count, void *userData);
+
   explicit Buzzer(int pin)
       : pin_(pin), sliceNum_(pwm_gpio_to_slice_num(pin_)),
         channel_(pwm_gpio_to_channel(pin_)), sysClockHz_(clock_get_hz(clk_sys)),
@@ -93,7 +314,10 @@ public:
     pwm_set_enabled(sliceNum_, true);
   }
 
-  ~Buzzer() { pwm_set_enabled(sliceNum_, false); }
+  ~Buzzer() {
+    stopAudio();
+    pwm_set_enabled(sliceNum_, false);
+  }
 
 private:
   uint16_t convertFrequencyToWrap(const float targetFrequencyHz) {
@@ -106,18 +330,105 @@ private:
   }
 
 public:
+  // Starts |midiNote| (69 is A4) and leaves it sounding until off() or the
+  // next note. Only looks the setting up: kNoteTable holds the closest
+  // divider and wrap for each note, so low notes do not overflow the wrap
+  // and high ones keep their pitch.
+  void playNote(uint8_t midiNote) {
+    const NoteSetting &setting = kNoteTable[midiNote & 127];
+    pwm_set_clkdiv_int_frac(sliceNum_, setting.divider16 >> 4,
+                            setting.divider16 & 15);
+    pwm_set_wrap(sliceNum_, setting.wrap);
+    pwm_set_chan_level(sliceNum_, channel_, setting.wrap / 4);
+  }
+
   void playFrequencyFor(const float frequency, const float durationMs) {
     const uint16_t wrap = convertFrequencyToWrap(frequency);
+    pwm_set_clkdiv(sliceNum_, clockDivider_);
     pwm_set_wrap(sliceNum_, wrap);
     pwm_set_chan_level(sliceNum_, channel_, wrap / 4);
     sleep_ms(durationMs);
   }
 
+  // Sample playback instead of square waves, until stopAudio(). The slice
+  // runs undivided and wraps once per sample; DMA paced by the wrap DREQ
+  // writes the next duty level into CC. Two channels take turns on the
+  // halves of a buffer, each chained to the other, and the IRQ refills the
+  // half that just finished from |source|, so the CPU runs once per
+  // kAudioBlock samples rather than once per sample.
+  void startAudio(uint32_t sampleRateHz, AudioSource source, void *userData) {
+    stopAudio();
+    source_ = source;
+    sourceData_ = userData;
+    audioWrap_ = sysClockHz_ / sampleRateHz - 1;
+    pwm_set_clkdiv(sliceNum_, 1.f);
+    pwm_set_wrap(sliceNum_, audioWrap_);
+
+    instance_ = this;
+    for (int half = 0; half < 2; ++half) {
+      fillAudio(half);
+      audioDma_[half] = dma_claim_unused_channel(true);
+    }
+    for (int half = 0; half < 2; ++half) {
+      dma_channel_config config =
+          dma_channel_get_default_config(audioDma_[half]);
+      channel_config_set_transfer_data_size(&config, DMA_SIZE_32);
+      channel_config_set_read_increment(&config, true);
+      channel_config_set_write_increment(&config, false);
+      channel_config_set_dreq(&config, pwm_get_dreq(sliceNum_));
+      channel_config_set_chain_to(&config, audioDma_[1 - half]);
+      dma_channel_configure(audioDma_[half], &config,
+                            &pwm_hw->slice[sliceNum_].cc, audioHalf(half),
+                            kAudioBlock, false);
+      dma_channel_set_irq0_enabled(audioDma_[half], true);
+    }
+    irq_add_shared_handler(DMA_IRQ_0, &Buzzer::onDmaIrq,
+                           PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+    irq_set_enabled(DMA_IRQ_0, true);
+    dma_channel_start(audioDma_[0]);
+  }
+
+  void stopAudio() {
+    if (source_ == nullptr) {
+      return;
+    }
+    // Unchain first, or aborting one channel could start the other.
+    for (int half = 0; half < 2; ++half) {
+      dma_channel_set_irq0_enabled(audioDma_[half], false);
+      dma_channel_config config =
+          dma_channel_get_default_config(audioDma_[half]);
+      channel_config_set_transfer_data_size(&config, DMA_SIZE_32);
+      channel_config_set_dreq(&config, pwm_get_dreq(sliceNum_));
+      dma_channel_set_config(audioDma_[half], &config, false);
+    }
+    for (int half = 0; half < 2; ++half) {
+      dma_channel_abort(audioDma_[half]);
+      dma_channel_unclaim(audioDma_[half]);
+    }
+    irq_remove_handler(DMA_IRQ_0, &Buzzer::onDmaIrq);
+    instance_ = nullptr;
+    source_ = nullptr;
+    pwm_set_clkdiv(sliceNum_, clockDivider_);
+    off();
+  }
+
+  void off() { pwm_set_chan_level(sliceNum_, channel_, 0); }
+
+  // A SongPlayer::NoteHandler for square-wave playback.
+  static void playSongNote(uint8_t midiNote, void *buzzer) {
+    if (midiNote < 128) {
+      static_cast<Buzzer *>(buzzer)->playNote(midiNote);
+    } else {
+      static_cast<Buzzer *>(buzzer)->off();
+    }
+  }
+
   void playFrequencyFor(const float frequency1, const float frequency2,
                         const float durationMs, uint64_t oneNoteDurationUs) {
     const uint16_t wrap1 = convertFrequencyToWrap(frequency1);
     const uint16_t wrap2 = convertFrequencyToWrap(frequency2);
     uint64_t iterations = 1000 * durationMs / oneNoteDurationUs / 2;
+    pwm_set_clkdiv(sliceNum_, clockDivider_);
     for (uint64_t i = 0; i < iterations; ++i) {
       pwm_set_wrap(sliceNum_, wrap1);
       pwm_set_chan_level(sliceNum_, channel_, wrap1 / 16);
@@ -129,11 +440,649 @@ public:
   }
 
 private:
+  static constexpr size_t kAudioBlock = 256;
+
+  uint32_t *audioHalf(int half) { return &audioLevels_[half * kAudioBlock]; }
+
+  // Renders a block and turns it into duty levels for our half of CC.
+  void fillAudio(int half) {
+    source_(audioSamples_.data(), kAudioBlock, sourceData_);
+    uint32_t *levels = audioHalf(half);
+    const uint32_t steps = audioWrap_ + 1;
+    for (size_t i = 0; i < kAudioBlock; ++i) {
+      const uint32_t level = ((audioSamples_[i] + 32768) * steps) >> 16;
+      levels[i] = level << (16 * channel_);
+    }
+  }
+
+  static void onDmaIrq() {
+    if (instance_ == nullptr) {
+      return;
+    }
+    for (int half = 0; half < 2; ++half) {
+      const uint channel = instance_->audioDma_[half];
+      if (dma_channel_get_irq0_status(channel)) {
+        dma_channel_acknowledge_irq0(channel);
+        // The other half is playing now; this one is next after it.
+        dma_channel_set_read_addr(channel, instance_->audioHalf(half), false);
+        instance_->fillAudio(half);
+      }
+    }
+  }
+
+private:
+  static inline Buzzer *instance_ = nullptr;
   const int pin_;
   const uint sliceNum_;
   const uint channel_;
   const uint32_t sysClockHz_;
   const float clockDivider_;
+
+  AudioSource source_ = nullptr;
+  void *sourceData_ = nullptr;
+  uint16_t audioWrap_ = 0;
+  std::array<uint, 2> audioDma_ = {};
+  std::array<uint32_t, 2 * kAudioBlock> audioLevels_ = {};
+  std::array<int16_t, kAudioBlock> audioSamples_ = {};
+};
+
+// Compile-time sine for the wavetables; |x| within [-pi, pi].
+constexpr double constexprSin(double x) {
+  double term = x;
+  double sum = x;
+  for (int n = 1; n < 12; ++n) {
+    term *= -x * x / ((2 * n) * (2 * n + 1));
+    sum += term;
+  }
+  return sum;
+}
+
+enum class Waveform { SINE, SQUARE, SAW, TRIANGLE };
+
+// One cycle of |waveform| in 256 signed 16-bit steps.
+constexpr std::array<int16_t, 256> makeWavetable(Waveform waveform) {
+  std::array<int16_t, 256> table = {};
+  for (int i = 0; i < 256; ++i) {
+    switch (waveform) {
+    case Waveform::SINE: {
+      const double x = 2 * M_PI * (i < 128 ? i : i - 256) / 256;
+      table[i] = int16_t(32767 * constexprSin(x));
+      break;
+    }
+    case Waveform::SQUARE:
+      table[i] = i < 128 ? 32767 : -32767;
+      break;
+    case Waveform::SAW:
+      table[i] = int16_t(-32768 + 256 * i);
+      break;
+    case Waveform::TRIANGLE:
+      table[i] = int16_t(i < 128 ? -32768 + 512 * i : 32767 - 512 * (i - 128));
+      break;
+    }
+  }
+  return table;
+}
+
+constexpr std::array<std::array<int16_t, 256>, 4> kWavetables = {
+    makeWavetable(Waveform::SINE), makeWavetable(Waveform::SQUARE),
+    makeWavetable(Waveform::SAW), makeWavetable(Waveform::TRIANGLE)};
+
+// Linear attack, decay and release, in samples, around a sustain level
+// where 65535 is full scale.
+struct Envelope {
+  uint32_t attackSamples;
+  uint32_t decaySamples;
+  uint16_t sustainLevel;
+  uint32_t releaseSamples;
+};
+
+// A wavetable oscillator with its own envelope. Levels are 8.24 fixed point
+// so that slow ramps still move every sample.
+class Voice {
+public:
+  void noteOn(uint32_t millihertz, uint32_t sampleRateHz, Waveform waveform,
+              const Envelope &envelope) {
+    increment_ = (uint64_t(millihertz) << 32) / (sampleRateHz * 1000ull);
+    table_ = &kWavetables[static_cast<int>(waveform)];
+    sustain_ = uint32_t(envelope.sustainLevel) << 8;
+    attackStep_ = kFullScale / std::max<uint32_t>(envelope.attackSamples, 1);
+    decayStep_ =
+        (kFullScale - sustain_) / std::max<uint32_t>(envelope.decaySamples, 1);
+    releaseSamples_ = std::max<uint32_t>(envelope.releaseSamples, 1);
+    stage_ = Stage::ATTACK;
+  }
+
+  void noteOff() {
+    if (stage_ != Stage::IDLE) {
+      releaseStep_ = std::max<uint32_t>(level_ / releaseSamples_, 1);
+      stage_ = Stage::RELEASE;
+    }
+  }
+
+  bool active() const { return stage_ != Stage::IDLE; }
+
+  int32_t next() {
+    switch (stage_) {
+    case Stage::IDLE:
+      return 0;
+    case Stage::ATTACK:
+      level_ = std::min(level_ + attackStep_, kFullScale);
+      if (level_ == kFullScale) {
+        stage_ = Stage::DECAY;
+      }
+      break;
+    case Stage::DECAY:
+      level_ = level_ > sustain_ + decayStep_ ? level_ - decayStep_ : sustain_;
+      if (level_ == sustain_) {
+        stage_ = Stage::SUSTAIN;
+      }
+      break;
+    case Stage::SUSTAIN:
+      break;
+    case Stage::RELEASE:
+      level_ = level_ > releaseStep_ ? level_ - releaseStep_ : 0;
+      if (level_ == 0) {
+        stage_ = Stage::IDLE;
+      }
+      break;
+    }
+    phase_ += increment_;
+    return ((*table_)[phase_ >> 24] * int32_t(level_ >> 9)) >> 15;
+  }
+
+private:
+  enum class Stage { IDLE, ATTACK, DECAY, SUSTAIN, RELEASE };
+
+  static constexpr uint32_t kFullScale = 1u << 24;
+
+  const std::array<int16_t, 256> *table_ = &kWavetables[0];
+  uint32_t phase_ = 0;
+  uint32_t increment_ = 0;
+  Stage stage_ = Stage::IDLE;
+  uint32_t level_ = 0;
+  uint32_t sustain_ = 0;
+  uint32_t attackStep_ = 0;
+  uint32_t decayStep_ = 0;
+  uint32_t releaseStep_ = 0;
+  uint32_t releaseSamples_ = 1;
+};
+
+// Mixes N voices into one stream for Buzzer::startAudio. Notes are started
+// and stopped from the main code while the DMA IRQ renders, so those calls
+// mask interrupts around the voice they touch.
+template <size_t N> class Mixer {
+public:
+  explicit Mixer(uint32_t sampleRateHz) : sampleRateHz_(sampleRateHz) {}
+
+  void noteOn(size_t voice, uint32_t millihertz, Waveform waveform,
+              const Envelope &envelope) {
+    const uint32_t status = save_and_disable_interrupts();
+    voices_[voice].noteOn(millihertz, sampleRateHz_, waveform, envelope);
+    restore_interrupts(status);
+  }
+
+  void noteOff(size_t voice) {
+    const uint32_t status = save_and_disable_interrupts();
+    voices_[voice].noteOff();
+    restore_interrupts(status);
+  }
+
+  uint32_t sampleRateHz() const { return sampleRateHz_; }
+
+  static void render(int16_t *samples, size_t count, void *userData) {
+    static_cast<Mixer *>(userData)->render(samples, count);
+  }
+
+private:
+  // N voices could add up to N times full scale but rarely do, so the sum
+  // is scaled down by at most 4 and clipped.
+  void render(int16_t *samples, size_t count) {
+    constexpr int kShift = N >= 4 ? 2 : N >= 2 ? 1 : 0;
+    for (size_t i = 0; i < count; ++i) {
+      int32_t sum = 0;
+      for (auto &voice : voices_) {
+        sum += voice.next();
+      }
+      samples[i] = std::clamp<int32_t>(sum >> kShift, -32768, 32767);
+    }
+  }
+
+private:
+  const uint32_t sampleRateHz_;
+  std::array<Voice, N> voices_;
+};
+
+// Runs a Mixer on core 1. The audio DMA IRQ is enabled from there, so all the
+// rendering happens on core 1 and core 0 only pushes note events through the
+// inter-core FIFO. Each event is one word: bit 31 set for note on, the voice
+// in bits 30..28 and the frequency in millihertz below. Pushing never waits
+// for room, since notes come from alarm callbacks and from code that has
+// interrupts masked: if core 1 falls behind, events are dropped and counted.
+template <size_t N> class Synth {
+  static_assert(N <= 8, "the voice has 3 bits in an event");
+
+public:
+  Synth(Buzzer &buzzer, uint32_t sampleRateHz, Waveform waveform,
+        const Envelope &envelope)
+      : buzzer_(buzzer), mixer_(sampleRateHz), waveform_(waveform),
+        envelope_(envelope) {}
+
+  // Only one Synth can own core 1.
+  void start() {
+    instance_ = this;
+    multicore_launch_core1(&Synth::core1Main);
+  }
+
+  void noteOn(size_t voice, float frequency) {
+    pushNoteOn(voice, uint32_t(frequency * 1000));
+  }
+
+  // Same from a MIDI note, without any float math.
+  void playNote(size_t voice, uint8_t midiNote) {
+    pushNoteOn(voice, kNoteMillihertz[midiNote & 127]);
+  }
+
+  void noteOff(size_t voice) { push(voice << kVoiceShift); }
+
+  // Events the FIFO had no room for.
+  uint32_t droppedEvents() const { return droppedEvents_; }
+
+  // Time spent rendering the last block, as a share of the time it plays
+  // for, and the worst so far.
+  uint32_t loadPercent() const { return loadPercent_; }
+  uint32_t peakLoadPercent() const { return peakLoadPercent_; }
+
+private:
+  static constexpr uint32_t kNoteOn = 1u << 31;
+  static constexpr int kVoiceShift = 28;
+  static constexpr uint32_t kFrequencyMask = (1u << kVoiceShift) - 1;
+
+  static void core1Main() { instance_->run(); }
+
+  void pushNoteOn(size_t voice, uint32_t millihertz) {
+    push(kNoteOn | voice << kVoiceShift | millihertz);
+  }
+
+  void push(uint32_t event) {
+    // An IRQ that pushes too must not fill the FIFO between the check and
+    // the push.
+    const uint32_t status = save_and_disable_interrupts();
+    if (multicore_fifo_wready()) {
+      multicore_fifo_push_blocking(event);
+    } else {
+      droppedEvents_ = droppedEvents_ + 1;
+    }
+    restore_interrupts(status);
+  }
+
+  void run() {
+    buzzer_.startAudio(mixer_.sampleRateHz(), &Synth::render, this);
+    while (true) {
+      const uint32_t event = multicore_fifo_pop_blocking();
+      const size_t voice = (event >> kVoiceShift) & 7;
+      if (event & kNoteOn) {
+        mixer_.noteOn(voice, event & kFrequencyMask, waveform_, envelope_);
+      } else {
+        mixer_.noteOff(voice);
+      }
+    }
+  }
+
+  static void render(int16_t *samples, size_t count, void *userData) {
+    auto *synth = static_cast<Synth *>(userData);
+    const uint64_t startUs = time_us_64();
+    Mixer<N>::render(samples, count, &synth->mixer_);
+    const uint64_t renderUs = time_us_64() - startUs;
+    const uint32_t rateHz = synth->mixer_.sampleRateHz();
+    const uint64_t blockUs = count * 1'000'000ull / rateHz;
+    const uint32_t load = renderUs * 100 / blockUs;
+    synth->loadPercent_ = load;
+    if (load > synth->peakLoadPercent_) {
+      synth->peakLoadPercent_ = load;
+    }
+  }
+
+private:
+  static inline Synth *instance_ = nullptr;
+  Buzzer &buzzer_;
+  Mixer<N> mixer_;
+  const Waveform waveform_;
+  const Envelope envelope_;
+
+  volatile uint32_t loadPercent_ = 0;
+  volatile uint32_t peakLoadPercent_ = 0;
+  volatile uint32_t droppedEvents_ = 0;
+};
+
+// What rendering costs with all N voices sounding: microseconds per block
+// and the share of a core that takes at |sampleRateHz|.
+template <size_t N>
+void printRenderCost(uint32_t sampleRateHz, const Envelope &envelope) {
+  constexpr size_t kBlock = 256;
+  constexpr int kBlocks = 16;
+  Mixer<N> mixer(sampleRateHz);
+  for (size_t voice = 0; voice < N; ++voice) {
+    mixer.noteOn(voice, 220'000 * (voice + 1), Waveform::TRIANGLE, envelope);
+  }
+  std::array<int16_t, kBlock> samples;
+  const uint64_t startUs = time_us_64();
+  for (int i = 0; i < kBlocks; ++i) {
+    Mixer<N>::render(samples.data(), samples.size(), &mixer);
+  }
+  const uint64_t renderUs = (time_us_64() - startUs) / kBlocks;
+  const uint64_t blockUs = kBlock * 1'000'000ull / sampleRateHz;
+  printf("%u voices: %llu us per %u samples, %llu%% of a core\n", unsigned(N),
+         static_cast<unsigned long long>(renderUs), unsigned(kBlock),
+         static_cast<unsigned long long>(renderUs * 100 / blockUs));
+}
+
+// Streams a song in the packed format midi_to_cpp.py emits:
+//
+//   3 bytes     microseconds per time unit, big-endian
+//   then events:
+//   0x00-0x7F   that MIDI note, then its length in units as a varint
+//   0x80-0xFE   the previous event again, 1 to 127 more times
+//   0xFF        a rest, then its length in units as a varint
+//
+// Varints hold 7 bits per byte, low bits first, with the top bit set on
+// every byte but the last. Notes take 2 bytes instead of a {float, float}
+// pair's 8, and repeats next to nothing; the song stays in flash.
+class PackedSong {
+public:
+  static constexpr uint8_t kRest = 0xFF;
+
+  struct Event {
+    uint8_t note; // kRest for a rest
+    uint32_t durationUs;
+  };
+
+  PackedSong(const uint8_t *data, size_t size)
+      : begin_(data + kHeaderSize), end_(data + size),
+        unitUs_(uint32_t(data[0]) << 16 | data[1] << 8 | data[2]) {
+    rewind();
+  }
+
+  void rewind() {
+    next_ = begin_;
+    repeats_ = 0;
+  }
+
+  // False once the song is over.
+  bool next(Event &event) {
+    if (repeats_ > 0) {
+      --repeats_;
+      event = last_;
+      return true;
+    }
+    if (next_ == end_) {
+      return false;
+    }
+    const uint8_t code = *next_++;
+    if (code >= 0x80 && code != kRest) {
+      repeats_ = code - 0x80;
+      event = last_;
+      return true;
+    }
+    last_ = {code, readVarint() * unitUs_};
+    event = last_;
+    return true;
+  }
+
+private:
+  static constexpr size_t kHeaderSize = 3;
+
+  uint32_t readVarint() {
+    uint32_t value = 0;
+    for (int shift = 0; next_ != end_; shift += 7) {
+      const uint8_t byte = *next_++;
+      value |= uint32_t(byte & 0x7F) << shift;
+      if ((byte & 0x80) == 0) {
+        break;
+      }
+    }
+    return value;
+  }
+
+private:
+  const uint8_t *const begin_;
+  const uint8_t *const end_;
+  const uint32_t unitUs_;
+  const uint8_t *next_ = nullptr;
+  int repeats_ = 0;
+  Event last_ = {kRest, 0};
+};
+
+// Plays a packed song from alarm callbacks, so the main loop stays free.
+// Each event calls |handler| from the timer IRQ with its MIDI note, or with
+// PackedSong::kRest for silence. The next alarm counts from when the last
+// one was due, so IRQ latency does not add up over the song. Controls mask
+// interrupts, since the alarm may fire in the middle of them.
+class SongPlayer {
+public:
+  using NoteHandler = void (*)(uint8_t note, void *userData);
+
+  SongPlayer(const uint8_t *song, size_t size, NoteHandler handler,
+             void *userData)
+      : song_(song, size), handler_(handler), userData_(userData) {}
+
+  ~SongPlayer() { pause(); }
+
+  void play() {
+    const uint32_t status = save_and_disable_interrupts();
+    if (alarm_ == 0) {
+      start();
+    }
+    restore_interrupts(status);
+  }
+
+  void pause() {
+    const uint32_t status = save_and_disable_interrupts();
+    stop();
+    restore_interrupts(status);
+  }
+
+  bool playing() const { return alarm_ != 0; }
+
+  // Jumps to |positionMs| into the song, playing on from there if it was
+  // playing.
+  void seek(uint32_t positionMs) {
+    const uint32_t status = save_and_disable_interrupts();
+    const bool wasPlaying = stop();
+    song_.rewind();
+    eventStartUs_ = 0;
+    const uint64_t targetUs = positionMs * 1000ull;
+    while (advance() && eventStartUs_ + event_.durationUs <= targetUs) {
+      eventStartUs_ += event_.durationUs;
+    }
+    if (loaded_) {
+      remainingUs_ = eventStartUs_ + event_.durationUs - targetUs;
+    }
+    if (wasPlaying) {
+      start();
+    }
+    restore_interrupts(status);
+  }
+
+  // 100 plays the song as written, 200 twice as fast. Applies from the next
+  // note on.
+  void setTempo(uint32_t percent) {
+    tempoPercent_ = std::max<uint32_t>(percent, 1);
+  }
+
+  // Whether to start over at the end rather than stop.
+  void setLooping(bool looping) { looping_ = looping; }
+
+  // Where in the song we are, in its own time, regardless of the tempo.
+  uint32_t positionMs() const {
+    const uint32_t status = save_and_disable_interrupts();
+    uint64_t remainingUs = remainingUs_;
+    if (alarm_ != 0) {
+      const uint64_t nowUs = time_us_64();
+      remainingUs = dueUs_ > nowUs ? toSongTime(dueUs_ - nowUs) : 0;
+    }
+    const uint64_t positionUs =
+        eventStartUs_ + std::min<uint64_t>(event_.durationUs - remainingUs,
+                                           event_.durationUs);
+    restore_interrupts(status);
+    return positionUs / 1000;
+  }
+
+private:
+  // Loads the next event that lasts at all; false at the end of the song.
+  bool advance() {
+    while (song_.next(event_)) {
+      if (event_.durationUs > 0) {
+        remainingUs_ = event_.durationUs;
+        loaded_ = true;
+        return true;
+      }
+    }
+    loaded_ = false;
+    return false;
+  }
+
+  // Plays what is left of the current event and arms the alarm for its end.
+  void start() {
+    if (!loaded_ && !advance()) {
+      return;
+    }
+    handler_(event_.note, userData_);
+    const uint64_t us = toPlayTime(remainingUs_);
+    dueUs_ = time_us_64() + us;
+    alarm_ = add_alarm_in_us(us, &SongPlayer::onAlarm, this, true);
+  }
+
+  // Returns whether it was playing.
+  bool stop() {
+    if (alarm_ == 0) {
+      return false;
+    }
+    cancel_alarm(alarm_);
+    alarm_ = 0;
+    const uint64_t nowUs = time_us_64();
+    remainingUs_ = dueUs_ > nowUs ? toSongTime(dueUs_ - nowUs) : 0;
+    handler_(PackedSong::kRest, userData_);
+    return true;
+  }
+
+  static int64_t onAlarm(alarm_id_t, void *userData) {
+    auto *player = static_cast<SongPlayer *>(userData);
+    return player->nextEvent();
+  }
+
+  int64_t nextEvent() {
+    eventStartUs_ += event_.durationUs;
+    if (!advance()) {
+      song_.rewind();
+      eventStartUs_ = 0;
+      if (!looping_ || !advance()) {
+        handler_(PackedSong::kRest, userData_);
+        alarm_ = 0;
+        return 0;
+      }
+    }
+    handler_(event_.note, userData_);
+    const uint64_t us = std::max<uint64_t>(toPlayTime(event_.durationUs), 1);
+    dueUs_ += us;
+    return -int64_t(us);
+  }
+
+  uint64_t toPlayTime(uint64_t songUs) const {
+    return songUs * 100 / tempoPercent_;
+  }
+
+  uint64_t toSongTime(uint64_t playUs) const {
+    return playUs * tempoPercent_ / 100;
+  }
+
+private:
+  PackedSong song_;
+  const NoteHandler handler_;
+  void *const userData_;
+
+  PackedSong::Event event_ = {PackedSong::kRest, 0};
+  bool loaded_ = false;
+  // Song time at which the current event started, and what is left of it
+  // while paused.
+  uint64_t eventStartUs_ = 0;
+  uint64_t remainingUs_ = 0;
+  uint64_t dueUs_ = 0;
+  volatile alarm_id_t alarm_ = 0;
+  volatile uint32_t tempoPercent_ = 100;
+  bool looping_ = true;
+};
+
+// 827 bytes, generated by midi_to_cpp.py.
+constexpr uint8_t kThroughFireAndFlames[] = {
+    0x00, 0x61, 0xA8, 0x30, 0x03, 0x37, 0x03, 0x3E, 0x03, 0x37, 0x03, 0x3F,
+    0x03, 0x37, 0x03, 0x3C, 0x03, 0x37, 0x03, 0x3E, 0x03, 0x37, 0x03, 0x3F,
+    0x03, 0x37, 0x03, 0x41, 0x03, 0x37, 0x03, 0x3E, 0x03, 0x37, 0x03, 0x43,
+    0x03, 0x37, 0x03, 0x3F, 0x03, 0x37, 0x03, 0x41, 0x03, 0x37, 0x03, 0x3E,
+    0x03, 0x37, 0x03, 0x3F, 0x03, 0x37, 0x03, 0x3C, 0x03, 0x37, 0x03, 0x3E,
+    0x03, 0x37, 0x03, 0x3A, 0x03, 0x37, 0x03, 0x30, 0x03, 0x37, 0x03, 0x3E,
+    0x03, 0x37, 0x03, 0x3F, 0x03, 0x37, 0x03, 0x3C, 0x03, 0x37, 0x03, 0x3E,
+    0x03, 0x37, 0x03, 0x3F, 0x03, 0x37, 0x03, 0x41, 0x03, 0x37, 0x03, 0x3E,
+    0x03, 0x37, 0x03, 0x43, 0x03, 0x37, 0x03, 0x3F, 0x03, 0x37, 0x03, 0x41,
+    0x03, 0x37, 0x03, 0x3E, 0x03, 0x37, 0x03, 0x3F, 0x03, 0x37, 0x03, 0x3C,
+    0x03, 0x37, 0x03, 0x3E, 0x03, 0x37, 0x03, 0x3A, 0x03, 0x37, 0x03, 0x2E,
+    0x03, 0x37, 0x03, 0x3E, 0x03, 0x37, 0x03, 0x3F, 0x03, 0x37, 0x03, 0x3C,
+    0x03, 0x37, 0x03, 0x3E, 0x03, 0x37, 0x03, 0x3F, 0x03, 0x37, 0x03, 0x41,
+    0x03, 0x37, 0x03, 0x3E, 0x03, 0x37, 0x03, 0x43, 0x03, 0x37, 0x03, 0x3F,
+    0x03, 0x37, 0x03, 0x41, 0x03, 0x37, 0x03, 0x3E, 0x03, 0x37, 0x03, 0x3F,
+    0x03, 0x37, 0x03, 0x3C, 0x03, 0x37, 0x03, 0x3E, 0x03, 0x37, 0x03, 0x3A,
+    0x03, 0x37, 0x03, 0x2C, 0x03, 0x37, 0x03, 0x3E, 0x03, 0x37, 0x03, 0x3F,
+    0x03, 0x37, 0x03, 0x3C, 0x03, 0x37, 0x03, 0x3E, 0x03, 0x37, 0x03, 0x3F,
+    0x03, 0x37, 0x03, 0x41, 0x03, 0x37, 0x03, 0x3E, 0x03, 0x37, 0x03, 0x43,
+    0x03, 0x37, 0x03, 0x3F, 0x03, 0x37, 0x03, 0x41, 0x03, 0x37, 0x03, 0x3E,
+    0x03, 0x37, 0x03, 0x3F, 0x03, 0x37, 0x03, 0x3C, 0x03, 0x37, 0x03, 0x3E,
+    0x03, 0x37, 0x03, 0x3A, 0x03, 0x37, 0x03, 0x30, 0x03, 0x37, 0x03, 0x3E,
+    0x03, 0x37, 0x03, 0x3F, 0x03, 0x37, 0x03, 0x3C, 0x03, 0x37, 0x03, 0x3E,
+    0x03, 0x37, 0x03, 0x3F, 0x03, 0x37, 0x03, 0x41, 0x03, 0x37, 0x03, 0x3E,
+    0x03, 0x37, 0x03, 0x43, 0x03, 0x37, 0x03, 0x3F, 0x03, 0x37, 0x03, 0x41,
+    0x03, 0x37, 0x03, 0x3E, 0x03, 0x37, 0x03, 0x3F, 0x03, 0x37, 0x03, 0x3C,
+    0x03, 0x37, 0x03, 0x3E, 0x03, 0x37, 0x03, 0x3A, 0x03, 0x37, 0x03, 0x30,
+    0x03, 0x37, 0x03, 0x3E, 0x03, 0x37, 0x03, 0x3F, 0x03, 0x37, 0x03, 0x3C,
+    0x03, 0x37, 0x03, 0x3E, 0x03, 0x37, 0x03, 0x3F, 0x03, 0x37, 0x03, 0x41,
+    0x03, 0x37, 0x03, 0x3E, 0x03, 0x37, 0x03, 0x43, 0x03, 0x37, 0x03, 0x3F,
+    0x03, 0x37, 0x03, 0x41, 0x03, 0x37, 0x03, 0x3E, 0x03, 0x37, 0x03, 0x3F,
+    0x03, 0x37, 0x03, 0x3C, 0x03, 0x37, 0x03, 0x3E, 0x03, 0x37, 0x03, 0x3A,
+    0x03, 0x37, 0x03, 0x2C, 0x03, 0x37, 0x03, 0x3E, 0x03, 0x37, 0x03, 0x3F,
+    0x03, 0x37, 0x03, 0x3C, 0x03, 0x37, 0x03, 0x3E, 0x03, 0x37, 0x03, 0x3F,
+    0x03, 0x37, 0x03, 0x41, 0x03, 0x37, 0x03, 0x3E, 0x03, 0x37, 0x03, 0x43,
+    0x03, 0x37, 0x03, 0x3F, 0x03, 0x37, 0x03, 0x41, 0x03, 0x37, 0x03, 0x3E,
+    0x03, 0x37, 0x03, 0x3F, 0x03, 0x37, 0x03, 0x3C, 0x03, 0x37, 0x03, 0x3E,
+    0x03, 0x37, 0x03, 0x3A, 0x03, 0x37, 0x03, 0x2B, 0x03, 0x37, 0x03, 0x3E,
+    0x03, 0x37, 0x03, 0x3F, 0x03, 0x37, 0x03, 0x3C, 0x03, 0x37, 0x03, 0x3E,
+    0x03, 0x37, 0x03, 0x3F, 0x03, 0x37, 0x03, 0x41, 0x03, 0x37, 0x03, 0x3E,
+    0x03, 0x37, 0x03, 0x2B, 0x03, 0x3F, 0x03, 0x3C, 0x03, 0x37, 0x03, 0x81,
+    0x3C, 0x03, 0x3F, 0x03, 0x43, 0x03, 0x44, 0x03, 0x43, 0x03, 0x3F, 0x03,
+    0x3C, 0x03, 0x37, 0x03, 0x3C, 0x03, 0x3F, 0x03, 0x48, 0x06, 0x48, 0x03,
+    0x80, 0x43, 0x03, 0x80, 0x48, 0x03, 0x82, 0x43, 0x03, 0x80, 0x48, 0x03,
+    0x80, 0x43, 0x03, 0x80, 0x48, 0x03, 0x82, 0x43, 0x03, 0x80, 0x48, 0x03,
+    0x82, 0x43, 0x03, 0x80, 0x48, 0x03, 0x80, 0x43, 0x03, 0x80, 0x4B, 0x06,
+    0x4B, 0x03, 0x80, 0x48, 0x03, 0x80, 0x4B, 0x03, 0x82, 0x48, 0x03, 0x80,
+    0x4B, 0x03, 0x80, 0x48, 0x03, 0x80, 0x4B, 0x06, 0x4B, 0x03, 0x80, 0x48,
+    0x03, 0x80, 0x4B, 0x03, 0x82, 0x48, 0x03, 0x80, 0x4B, 0x03, 0x80, 0x48,
+    0x03, 0x80, 0x48, 0x06, 0x48, 0x03, 0x80, 0x44, 0x03, 0x80, 0x48, 0x03,
+    0x82, 0x44, 0x03, 0x80, 0x48, 0x03, 0x80, 0x44, 0x03, 0x80, 0x48, 0x06,
+    0x48, 0x03, 0x80, 0x44, 0x03, 0x80, 0x48, 0x03, 0x82, 0x44, 0x03, 0x80,
+    0x48, 0x03, 0x80, 0x44, 0x03, 0x80, 0x48, 0x06, 0x48, 0x03, 0x80, 0x43,
+    0x03, 0x80, 0x48, 0x03, 0x82, 0x43, 0x03, 0x80, 0x48, 0x03, 0x80, 0x43,
+    0x03, 0x81, 0x46, 0x03, 0x48, 0x03, 0x4A, 0x03, 0x46, 0x03, 0x48, 0x03,
+    0x4A, 0x03, 0xFF, 0x03, 0x48, 0x03, 0xFF, 0x02, 0x4A, 0x02, 0x4D, 0x06,
+    0x4B, 0x03, 0x4F, 0x0B, 0x48, 0x03, 0x81, 0x43, 0x03, 0x80, 0x48, 0x03,
+    0x82, 0x43, 0x03, 0x80, 0x48, 0x03, 0x80, 0x43, 0x03, 0x80, 0x48, 0x03,
+    0x82, 0x43, 0x03, 0x80, 0x48, 0x03, 0x82, 0x43, 0x03, 0x80, 0x48, 0x03,
+    0x80, 0x43, 0x03, 0x80, 0x4B, 0x06, 0x4B, 0x03, 0x80, 0x48, 0x03, 0x80,
+    0x4B, 0x03, 0x82, 0x48, 0x03, 0x80, 0x4B, 0x03, 0x80, 0x48, 0x03, 0x80,
+    0x4B, 0x06, 0x4B, 0x03, 0x80, 0x48, 0x03, 0x80, 0x4B, 0x03, 0x82, 0x48,
+    0x03, 0x80, 0x4B, 0x03, 0x80, 0x48, 0x03, 0x80, 0x48, 0x06, 0x48, 0x03,
+    0x80, 0x44, 0x03, 0x80, 0x48, 0x03, 0x82, 0x44, 0x03, 0x80, 0x48, 0x03,
+    0x80, 0x44, 0x03, 0x80, 0x48, 0x06, 0x48, 0x03, 0x80, 0x44, 0x03, 0x80,
+    0x48, 0x03, 0x82, 0x44, 0x03, 0x80, 0x48, 0x03, 0x80, 0x44, 0x03, 0x80,
+    0x48, 0x06, 0x41, 0x03, 0x3C, 0x03, 0x3F, 0x03, 0x41, 0x03, 0x43, 0x03,
+    0x46, 0x03, 0x48, 0x03, 0x44, 0x03, 0x41, 0x03, 0x3C, 0x03, 0x3F, 0x03,
+    0x41, 0x03, 0x43, 0x03, 0x44, 0x03, 0x2C, 0x03, 0x8E, 0x30, 0x30,
 };
 
 int main() {
@@ -195,179 +1144,68 @@ int main() {
 
   Buzzer buzzer(13);
 
-  std::array<std::pair<float, float>, 167 * 3> throughFireAndFlames = {
-      {{130.81, 75.000f},  {196.00, 75.000f},  {293.66, 75.000f},
-       {196.00, 75.000f},  {311.13, 75.000f},  {196.00, 75.000f},
-       {261.63, 75.000f},  {196.00, 75.000f},  {293.66, 75.000f},
-       {196.00, 75.000f},  {311.13, 75.000f},  {196.00, 75.000f},
-       {349.23, 75.000f},  {196.00, 75.000f},  {293.66, 75.000f},
-       {196.00, 75.000f},  {392.00, 75.000f},  {196.00, 75.000f},
-       {311.13, 75.000f},  {196.00, 75.000f},  {349.23, 75.000f},
-       {196.00, 75.000f},  {293.66, 75.000f},  {196.00, 75.000f},
-       {311.13, 75.000f},  {196.00, 75.000f},  {261.63, 75.000f},
-       {196.00, 75.000f},  {293.66, 75.000f},  {196.00, 75.000f},
-       {233.08, 75.000f},  {196.00, 75.000f},  {130.81, 75.000f},
-       {196.00, 75.000f},  {293.66, 75.000f},  {196.00, 75.000f},
-       {311.13, 75.000f},  {196.00, 75.000f},  {261.63, 75.000f},
-       {196.00, 75.000f},  {293.66, 75.000f},  {196.00, 75.000f},
-       {311.13, 75.000f},  {196.00, 75.000f},  {349.23, 75.000f},
-       {196.00, 75.000f},  {293.66, 75.000f},  {196.00, 75.000f},
-       {392.00, 75.000f},  {196.00, 75.000f},  {311.13, 75.000f},
-       {196.00, 75.000f},  {349.23, 75.000f},  {196.00, 75.000f},
-       {293.66, 75.000f},  {196.00, 75.000f},  {311.13, 75.000f},
-       {196.00, 75.000f},  {261.63, 75.000f},  {196.00, 75.000f},
-       {293.66, 75.000f},  {196.00, 75.000f},  {233.08, 75.000f},
-       {196.00, 75.000f},  {116.54, 75.000f},  {196.00, 75.000f},
-       {293.66, 75.000f},  {196.00, 75.000f},  {311.13, 75.000f},
-       {196.00, 75.000f},  {261.63, 75.000f},  {196.00, 75.000f},
-       {293.66, 75.000f},  {196.00, 75.000f},  {311.13, 75.000f},
-       {196.00, 75.000f},  {349.23, 75.000f},  {196.00, 75.000f},
-       {293.66, 75.000f},  {196.00, 75.000f},  {392.00, 75.000f},
-       {196.00, 75.000f},  {311.13, 75.000f},  {196.00, 75.000f},
-       {349.23, 75.000f},  {196.00, 75.000f},  {293.66, 75.000f},
-       {196.00, 75.000f},  {311.13, 75.000f},  {196.00, 75.000f},
-       {261.63, 75.000f},  {196.00, 75.000f},  {293.66, 75.000f},
-       {196.00, 75.000f},  {233.08, 75.000f},  {196.00, 75.000f},
-       {103.83, 75.000f},  {196.00, 75.000f},  {293.66, 75.000f},
-       {196.00, 75.000f},  {311.13, 75.000f},  {196.00, 75.000f},
-       {261.63, 75.000f},  {196.00, 75.000f},  {293.66, 75.000f},
-       {196.00, 75.000f},  {311.13, 75.000f},  {196.00, 75.000f},
-       {349.23, 75.000f},  {196.00, 75.000f},  {293.66, 75.000f},
-       {196.00, 75.000f},  {392.00, 75.000f},  {196.00, 75.000f},
-       {311.13, 75.000f},  {196.00, 75.000f},  {349.23, 75.000f},
-       {196.00, 75.000f},  {293.66, 75.000f},  {196.00, 75.000f},
-       {311.13, 75.000f},  {196.00, 75.000f},  {261.63, 75.000f},
-       {196.00, 75.000f},  {293.66, 75.000f},  {196.00, 75.000f},
-       {233.08, 75.000f},  {196.00, 75.000f},  {130.81, 75.000f},
-       {196.00, 75.000f},  {293.66, 75.000f},  {196.00, 75.000f},
-       {311.13, 75.000f},  {196.00, 75.000f},  {261.63, 75.000f},
-       {196.00, 75.000f},  {293.66, 75.000f},  {196.00, 75.000f},
-       {311.13, 75.000f},  {196.00, 75.000f},  {349.23, 75.000f},
-       {196.00, 75.000f},  {293.66, 75.000f},  {196.00, 75.000f},
-       {392.00, 75.000f},  {196.00, 75.000f},  {311.13, 75.000f},
-       {196.00, 75.000f},  {349.23, 75.000f},  {196.00, 75.000f},
-       {293.66, 75.000f},  {196.00, 75.000f},  {311.13, 75.000f},
-       {196.00, 75.000f},  {261.63, 75.000f},  {196.00, 75.000f},
-       {293.66, 75.000f},  {196.00, 75.000f},  {233.08, 75.000f},
-       {196.00, 75.000f},  {130.81, 75.000f},  {196.00, 75.000f},
-       {293.66, 75.000f},  {196.00, 75.000f},  {311.13, 75.000f},
-       {196.00, 75.000f},  {261.63, 75.000f},  {196.00, 75.000f},
-       {293.66, 75.000f},  {196.00, 75.000f},  {311.13, 75.000f},
-       {196.00, 75.000f},  {349.23, 75.000f},  {196.00, 75.000f},
-       {293.66, 75.000f},  {196.00, 75.000f},  {392.00, 75.000f},
-       {196.00, 75.000f},  {311.13, 75.000f},  {196.00, 75.000f},
-       {349.23, 75.000f},  {196.00, 75.000f},  {293.66, 75.000f},
-       {196.00, 75.000f},  {311.13, 75.000f},  {196.00, 75.000f},
-       {261.63, 75.000f},  {196.00, 75.000f},  {293.66, 75.000f},
-       {196.00, 75.000f},  {233.08, 75.000f},  {196.00, 75.000f},
-       {103.83, 75.000f},  {196.00, 75.000f},  {293.66, 75.000f},
-       {196.00, 75.000f},  {311.13, 75.000f},  {196.00, 75.000f},
-       {261.63, 75.000f},  {196.00, 75.000f},  {293.66, 75.000f},
-       {196.00, 75.000f},  {311.13, 75.000f},  {196.00, 75.000f},
-       {349.23, 75.000f},  {196.00, 75.000f},  {293.66, 75.000f},
-       {196.00, 75.000f},  {392.00, 75.000f},  {196.00, 75.000f},
-       {311.13, 75.000f},  {196.00, 75.000f},  {349.23, 75.000f},
-       {196.00, 75.000f},  {293.66, 75.000f},  {196.00, 75.000f},
-       {311.13, 75.000f},  {196.00, 75.000f},  {261.63, 75.000f},
-       {196.00, 75.000f},  {293.66, 75.000f},  {196.00, 75.000f},
-       {233.08, 75.000f},  {196.00, 75.000f},  {98.00, 75.000f},
-       {196.00, 75.000f},  {293.66, 75.000f},  {196.00, 75.000f},
-       {311.13, 75.000f},  {196.00, 75.000f},  {261.63, 75.000f},
-       {196.00, 75.000f},  {293.66, 75.000f},  {196.00, 75.000f},
-       {311.13, 75.000f},  {196.00, 75.000f},  {349.23, 75.000f},
-       {196.00, 75.000f},  {293.66, 75.000f},  {196.00, 75.000f},
-       {98.00, 75.000f},   {311.13, 75.000f},  {261.63, 75.000f},
-       {196.00, 75.000f},  {196.00, 75.000f},  {196.00, 75.000f},
-       {261.63, 75.000f},  {311.13, 75.000f},  {392.00, 75.000f},
-       {415.30, 75.000f},  {392.00, 75.000f},  {311.13, 75.000f},
-       {261.63, 75.000f},  {196.00, 75.000f},  {261.63, 75.000f},
-       {311.13, 75.000f},  {523.25, 150.000f}, {523.25, 75.000f},
-       {523.25, 75.000f},  {392.00, 75.000f},  {392.00, 75.000f},
-       {523.25, 75.000f},  {523.25, 75.000f},  {523.25, 75.000f},
-       {523.25, 75.000f},  {392.00, 75.000f},  {392.00, 75.000f},
-       {523.25, 75.000f},  {523.25, 75.000f},  {392.00, 75.000f},
-       {392.00, 75.000f},  {523.25, 75.000f},  {523.25, 75.000f},
-       {523.25, 75.000f},  {523.25, 75.000f},  {392.00, 75.000f},
-       {392.00, 75.000f},  {523.25, 75.000f},  {523.25, 75.000f},
-       {523.25, 75.000f},  {523.25, 75.000f},  {392.00, 75.000f},
-       {392.00, 75.000f},  {523.25, 75.000f},  {523.25, 75.000f},
-       {392.00, 75.000f},  {392.00, 75.000f},  {622.25, 150.000f},
-       {622.25, 75.000f},  {622.25, 75.000f},  {523.25, 75.000f},
-       {523.25, 75.000f},  {622.25, 75.000f},  {622.25, 75.000f},
-       {622.25, 75.000f},  {622.25, 75.000f},  {523.25, 75.000f},
-       {523.25, 75.000f},  {622.25, 75.000f},  {622.25, 75.000f},
-       {523.25, 75.000f},  {523.25, 75.000f},  {622.25, 150.000f},
-       {622.25, 75.000f},  {622.25, 75.000f},  {523.25, 75.000f},
-       {523.25, 75.000f},  {622.25, 75.000f},  {622.25, 75.000f},
-       {622.25, 75.000f},  {622.25, 75.000f},  {523.25, 75.000f},
-       {523.25, 75.000f},  {622.25, 75.000f},  {622.25, 75.000f},
-       {523.25, 75.000f},  {523.25, 75.000f},  {523.25, 150.000f},
-       {523.25, 75.000f},  {523.25, 75.000f},  {415.30, 75.000f},
-       {415.30, 75.000f},  {523.25, 75.000f},  {523.25, 75.000f},
-       {523.25, 75.000f},  {523.25, 75.000f},  {415.30, 75.000f},
-       {415.30, 75.000f},  {523.25, 75.000f},  {523.25, 75.000f},
-       {415.30, 75.000f},  {415.30, 75.000f},  {523.25, 150.000f},
-       {523.25, 75.000f},  {523.25, 75.000f},  {415.30, 75.000f},
-       {415.30, 75.000f},  {523.25, 75.000f},  {523.25, 75.000f},
-       {523.25, 75.000f},  {523.25, 75.000f},  {415.30, 75.000f},
-       {415.30, 75.000f},  {523.25, 75.000f},  {523.25, 75.000f},
-       {415.30, 75.000f},  {415.30, 75.000f},  {523.25, 150.000f},
-       {523.25, 75.000f},  {523.25, 75.000f},  {392.00, 75.000f},
-       {392.00, 75.000f},  {523.25, 75.000f},  {523.25, 75.000f},
-       {523.25, 75.000f},  {523.25, 75.000f},  {392.00, 75.000f},
-       {392.00, 75.000f},  {523.25, 75.000f},  {523.25, 75.000f},
-       {392.00, 75.000f},  {392.00, 75.000f},  {392.00, 75.000f},
-       {466.16, 75.000f},  {523.25, 75.000f},  {587.33, 75.000f},
-       {466.16, 75.000f},  {523.25, 75.000f},  {587.33, 75.000f},
-       {523.25, 75.000f},  {622.25, 50.000f},  {587.33, 50.000f},
-       {698.46, 0.000f},   {622.25, 75.000f},  {783.99, 75.000f},
-       {622.25, 0.000f},   {523.25, 75.000f},  {523.25, 75.000f},
-       {523.25, 75.000f},  {392.00, 75.000f},  {392.00, 75.000f},
-       {523.25, 75.000f},  {523.25, 75.000f},  {523.25, 75.000f},
-       {523.25, 75.000f},  {392.00, 75.000f},  {392.00, 75.000f},
-       {523.25, 75.000f},  {523.25, 75.000f},  {392.00, 75.000f},
-       {392.00, 75.000f},  {523.25, 75.000f},  {523.25, 75.000f},
-       {523.25, 75.000f},  {523.25, 75.000f},  {392.00, 75.000f},
-       {392.00, 75.000f},  {523.25, 75.000f},  {523.25, 75.000f},
-       {523.25, 75.000f},  {523.25, 75.000f},  {392.00, 75.000f},
-       {392.00, 75.000f},  {523.25, 75.000f},  {523.25, 75.000f},
-       {392.00, 75.000f},  {392.00, 75.000f},  {622.25, 150.000f},
-       {622.25, 75.000f},  {622.25, 75.000f},  {523.25, 75.000f},
-       {523.25, 75.000f},  {622.25, 75.000f},  {622.25, 75.000f},
-       {622.25, 75.000f},  {622.25, 75.000f},  {523.25, 75.000f},
-       {523.25, 75.000f},  {622.25, 75.000f},  {622.25, 75.000f},
-       {523.25, 75.000f},  {523.25, 75.000f},  {622.25, 150.000f},
-       {622.25, 75.000f},  {622.25, 75.000f},  {523.25, 75.000f},
-       {523.25, 75.000f},  {622.25, 75.000f},  {622.25, 75.000f},
-       {622.25, 75.000f},  {622.25, 75.000f},  {523.25, 75.000f},
-       {523.25, 75.000f},  {622.25, 75.000f},  {622.25, 75.000f},
-       {523.25, 75.000f},  {523.25, 75.000f},  {523.25, 150.000f},
-       {523.25, 75.000f},  {523.25, 75.000f},  {415.30, 75.000f},
-       {415.30, 75.000f},  {523.25, 75.000f},  {523.25, 75.000f},
-       {523.25, 75.000f},  {523.25, 75.000f},  {415.30, 75.000f},
-       {415.30, 75.000f},  {523.25, 75.000f},  {523.25, 75.000f},
-       {415.30, 75.000f},  {415.30, 75.000f},  {523.25, 150.000f},
-       {523.25, 75.000f},  {523.25, 75.000f},  {415.30, 75.000f},
-       {415.30, 75.000f},  {523.25, 75.000f},  {523.25, 75.000f},
-       {523.25, 75.000f},  {523.25, 75.000f},  {415.30, 75.000f},
-       {415.30, 75.000f},  {523.25, 75.000f},  {523.25, 75.000f},
-       {415.30, 75.000f},  {415.30, 75.000f},  {523.25, 150.000f},
-       {349.23, 75.000f},  {261.63, 75.000f},  {311.13, 75.000f},
-       {349.23, 75.000f},  {392.00, 75.000f},  {466.16, 75.000f},
-       {523.25, 75.000f},  {415.30, 75.000f},  {349.23, 75.000f},
-       {261.63, 75.000f},  {311.13, 75.000f},  {349.23, 75.000f},
-       {392.00, 75.000f},  {415.30, 75.000f},  {103.83, 75.000f},
-       {103.83, 75.000f},  {103.83, 75.000f},  {103.83, 75.000f},
-       {103.83, 75.000f},  {103.83, 75.000f},  {103.83, 75.000f},
-       {103.83, 75.000f},  {103.83, 75.000f},  {103.83, 75.000f},
-       {103.83, 75.000f},  {103.83, 75.000f},  {103.83, 75.000f},
-       {103.83, 75.000f},  {103.83, 75.000f},  {103.83, 75.000f},
-       {130.81, 1200.000f}}};
+  printNoteTable();
+
+  constexpr uint32_t kSampleRateHz = 22050;
+  constexpr Envelope kPluck = {kSampleRateHz / 200, kSampleRateHz / 20, 40000,
+                               kSampleRateHz / 25};
+  printRenderCost<1>(kSampleRateHz, kPluck);
+  printRenderCost<2>(kSampleRateHz, kPluck);
+  printRenderCost<4>(kSampleRateHz, kPluck);
+  printRenderCost<8>(kSampleRateHz, kPluck);
+
+  constexpr size_t kVoices = 4;
+  Synth<kVoices> synth(buzzer, kSampleRateHz, Waveform::TRIANGLE, kPluck);
+  synth.start();
+  // Each note takes the next voice, so releases ring on under the next ones.
+  struct SynthNotes {
+    Synth<kVoices> &synth;
+    size_t voice;
+  } synthNotes = {synth, 0};
+  const auto playOnSynth = [](uint8_t note, void *userData) {
+    auto &notes = *static_cast<SynthNotes *>(userData);
+    notes.synth.noteOff(notes.voice);
+    if (note != PackedSong::kRest) {
+      notes.voice = (notes.voice + 1) % kVoices;
+      notes.synth.playNote(notes.voice, note);
+    }
+  };
+  SongPlayer player(kThroughFireAndFlames, sizeof(kThroughFireAndFlames),
+                    playOnSynth, &synthNotes);
+  player.play();
 
+  // The song plays from alarms; all this loop does is take requests. The
+  // first button pauses and resumes, the second restarts the song, the
+  // third skips 10 s ahead, and the knob sets the tempo from 50% to 200%.
+  Button playButton(2);
+  Button restartButton(3);
+  Button skipButton(4);
+  Knob tempoKnob(26, 0);
+  Led led(25);
+  uint32_t loops = 0;
   while (1) {
-    for (const auto &[frequency, duration] : throughFireAndFlames) {
-      buzzer.playFrequencyFor(frequency, duration);
+    if (playButton.is_pressed()) {
+      if (player.playing()) {
+        player.pause();
+      } else {
+        player.play();
+      }
+    }
+    if (restartButton.is_pressed()) {
+      player.seek(0);
+    }
+    if (skipButton.is_pressed()) {
+      player.seek(player.positionMs() + 10'000);
+    }
+    player.setTempo(50 + uint32_t(150 * tempoKnob.read()));
+    if (++loops % 50 == 0) {
+      led.toggle();
+      printf("at %u ms, synth load %u%%, peak %u%%, %u events dropped\n",
+             unsigned(player.positionMs()), unsigned(synth.loadPercent()),
+             unsigned(synth.peakLoadPercent()),
+             unsigned(synth.droppedEvents()));
     }
+    sleep_ms(20);
   }
 
   return 0;
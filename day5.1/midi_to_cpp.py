@@ -1,33 +1,257 @@
+"""Converts a MIDI file into a song table for blink.cpp."""
+
+import argparse
+import collections
+import math
+import sys
+
 import mido
 
 def midi_note_to_frequency(note):
     """Convert MIDI note number to frequency in Hz."""
     return 440.0 * (2.0 ** ((note - 69) / 12.0))
 
-def midi_to_frequency_duration_pairs(midi_file):
-    """Convert MIDI file to frequency-duration pairs (directly using time)."""
-    mid = mido.MidiFile(midi_file)
+# One sounding note, in absolute ticks.
+Note = collections.namedtuple('Note', 'start end note track channel')
+
+PERCUSSION_CHANNEL = 9
+DEFAULT_TEMPO = 500000  # 120 BPM until the file says otherwise
+
+def read_notes(mid, skip_percussion=True):
+    """Every note of every track and channel, sorted by start."""
+    notes = []
+    for track_index, track in enumerate(mid.tracks):
+        tick = 0
+        # A note can be struck again before it is released; pair each
+        # release with the oldest strike.
+        sounding = collections.defaultdict(list)
+        for msg in track:
+            tick += msg.time
+            if msg.type not in ('note_on', 'note_off'):
+                continue
+            if skip_percussion and msg.channel == PERCUSSION_CHANNEL:
+                continue
+            key = (msg.channel, msg.note)
+            if msg.type == 'note_on' and msg.velocity > 0:
+                sounding[key].append(tick)
+            elif sounding[key]:
+                start = sounding[key].pop(0)
+                notes.append(Note(start, tick, msg.note, track_index,
+                                  msg.channel))
+        # Notes still held at the end of the track end with it.
+        for (channel, note), starts in sounding.items():
+            for start in starts:
+                notes.append(Note(start, tick, note, track_index, channel))
+    notes = [n for n in notes if n.end > n.start]
+    notes.sort(key=lambda n: (n.start, -n.note))
+    return notes
+
+class TempoMap:
+    """Turns absolute ticks into microseconds across tempo changes."""
+
+    def __init__(self, mid):
+        self.ticks_per_beat = mid.ticks_per_beat
+        changes = {}
+        for track in mid.tracks:
+            tick = 0
+            for msg in track:
+                tick += msg.time
+                if msg.type == 'set_tempo':
+                    changes[tick] = msg.tempo
+        # (tick, microseconds at that tick, tempo from there on)
+        self.segments = [(0, 0.0, changes.pop(0, DEFAULT_TEMPO))]
+        for tick in sorted(changes):
+            last_tick, last_us, tempo = self.segments[-1]
+            us = last_us + (tick - last_tick) * tempo / self.ticks_per_beat
+            self.segments.append((tick, us, changes[tick]))
+
+    def us(self, tick):
+        for start_tick, start_us, tempo in reversed(self.segments):
+            if tick >= start_tick:
+                return start_us + (tick - start_tick) * tempo / \
+                    self.ticks_per_beat
+        return 0.0
+
+def reduce_monophonic(notes, strategy, track_order=()):
+    """One line of (start, end, note) in ticks, picking a note wherever
+    several sound at once.
+
+    'highest' keeps the highest note. 'track' keeps the note from the
+    track listed first in track_order (unlisted tracks come after, by
+    number), then the highest.
+    """
+    def rank(n):
+        if strategy == 'track':
+            order = (track_order.index(n.track) if n.track in track_order
+                     else len(track_order) + n.track)
+            return (-order, n.note)
+        return (n.note,)
+
+    times = sorted({t for n in notes for t in (n.start, n.end)})
+    line = []
+    current = None
+    active = []
+    index = 0
+    for start, end in zip(times, times[1:]):
+        active = [n for n in active if n.end > start]
+        while index < len(notes) and notes[index].start <= start:
+            active.append(notes[index])
+            index += 1
+        chosen = max(active, key=rank) if active else None
+        # A note that keeps winning while others come and go is one event;
+        # a new strike of the same pitch is another.
+        if chosen is not None and chosen is current:
+            line[-1] = (line[-1][0], end, chosen.note)
+        elif chosen is not None:
+            line.append((start, end, chosen.note))
+        current = chosen
+    return line
+
+def split_voices(notes, voices):
+    """Deals the notes out to voices so none overlaps within a voice: one
+    line of (start, end, note) per voice for the synth. Notes that find
+    no free voice are dropped."""
+    lines = [[] for _ in range(voices)]
+    dropped = 0
+    for n in notes:
+        free = [line for line in lines if not line or line[-1][1] <= n.start]
+        if not free:
+            dropped += 1
+            continue
+        # The voice that has been quiet longest, so releases ring out.
+        line = min(free, key=lambda line: line[-1][1] if line else -1)
+        line.append((n.start, n.end, n.note))
+    if dropped:
+        print(f'{dropped} notes dropped: more than {voices} at once',
+              file=sys.stderr)
+    return lines
+
+REST = None
+
+def timed_events(line, tempo_map):
+    """(note, start_us, end_us) with explicit rests, from tick 0 on."""
+    events = []
+    now = 0
+    for start, end, note in line:
+        if start > now:
+            events.append((REST, tempo_map.us(now), tempo_map.us(start)))
+        events.append((note, tempo_map.us(start), tempo_map.us(end)))
+        now = end
+    return events
+
+# Packed song format, read by PackedSong in blink.cpp:
+#
+#   3 bytes     microseconds per time unit, big-endian
+#   then events:
+#   0x00-0x7F   that MIDI note, then its length in units as a varint
+#   0x80-0xFE   the previous event again, 1 to 127 more times
+#   0xFF        a rest, then its length in units as a varint
+#
+# Varints hold 7 bits per byte, low bits first, with the top bit set on
+# every byte but the last.
+REST_CODE = 0xFF
+MAX_REPEAT = REST_CODE - 0x80
+
+def varint(value):
+    data = []
+    while True:
+        byte = value & 0x7F
+        value >>= 7
+        if value:
+            data.append(byte | 0x80)
+        else:
+            data.append(byte)
+            return data
+
+def quantize(events, min_unit_us):
+    """(note, units) pairs and the unit. The unit is the largest that every
+    length is a whole number of, but no finer than min_unit_us. Event
+    boundaries are rounded rather than lengths, so rounding never adds up
+    to drift."""
+    boundaries = [round(us) for _, start, end in events for us in (start,
+                                                                    end)]
+    unit_us = 0
+    for us in boundaries:
+        unit_us = math.gcd(unit_us, us)
+    if unit_us < min_unit_us:
+        unit_us = min_unit_us
+    assert unit_us < 1 << 24, 'time unit does not fit the header'
     pairs = []
-    active_notes = {}
-
-    for msg in mid:
-        if msg.type == 'note_on' and msg.velocity > 0:
-            # Note ON: Start tracking
-            active_notes[msg.note] = msg.time
-        elif msg.type == 'note_off' or (msg.type == 'note_on' and msg.velocity == 0):
-            # Note OFF: Calculate duration
-            if msg.note in active_notes:
-                duration_seconds = msg.time  # Directly use the time
-                frequency = midi_note_to_frequency(msg.note)
-                pairs.append((frequency, duration_seconds))
-                del active_notes[msg.note]
-
-    return pairs
-
-# Usage
-midi_file = 'single_voice.mid'
-pairs = midi_to_frequency_duration_pairs(midi_file)
-
-# Print the frequency-duration pairs
-for frequency, duration in pairs:
-    print(f"{{{frequency:.2f}, {1000*duration:.3f}f}},")
+    for note, start, end in events:
+        units = round(end / unit_us) - round(start / unit_us)
+        if units > 0:
+            pairs.append((note, units))
+    return pairs, unit_us
+
+def pack_song(pairs, unit_us):
+    """Pack (note, units) pairs; a note of REST is a rest."""
+    data = [unit_us >> 16, (unit_us >> 8) & 0xFF, unit_us & 0xFF]
+    previous = None
+    repeats = 0
+    for event in pairs:
+        if event == previous and repeats < MAX_REPEAT:
+            repeats += 1
+            continue
+        if repeats:
+            data.append(0x7F + repeats)
+            repeats = 0
+        note, units = event
+        data.append(REST_CODE if note is REST else note)
+        data.extend(varint(units))
+        previous = event
+    if repeats:
+        data.append(0x7F + repeats)
+    return data
+
+def print_packed(name, data):
+    print(f'// {len(data)} bytes, generated by midi_to_cpp.py.')
+    print(f'constexpr uint8_t {name}[] = {{')
+    for start in range(0, len(data), 12):
+        row = ', '.join(f'0x{byte:02X}' for byte in data[start:start + 12])
+        print(f'    {row},')
+    print('};')
+
+def print_pairs(pairs, unit_us):
+    for note, units in pairs:
+        frequency = 0 if note is REST else midi_note_to_frequency(note)
+        print(f"{{{frequency:.2f}, {units * unit_us / 1000:.3f}f}},")
+
+parser = argparse.ArgumentParser(description=__doc__)
+parser.add_argument('midi_file', nargs='?', default='single_voice.mid')
+parser.add_argument('--name', default='kSong',
+                    help='name of the emitted C++ array')
+parser.add_argument('--strategy', choices=('highest', 'track'),
+                    default='highest',
+                    help='which note to keep where several sound at once')
+parser.add_argument('--track-order', default='',
+                    help='comma-separated track numbers, most important '
+                    'first, for --strategy=track')
+parser.add_argument('--voices', type=int, default=1,
+                    help='emit this many packed streams, <name>0, <name>1..., '
+                    'for the synth instead of reducing to one line')
+parser.add_argument('--percussion', action='store_true',
+                    help='keep channel 10, which has drums, not pitches')
+parser.add_argument('--min-unit-us', type=int, default=1000,
+                    help='finest time unit; lengths are rounded to it')
+parser.add_argument('--pairs', action='store_true',
+                    help='emit {frequency, milliseconds} pairs instead, '
+                    'with rests at 0 Hz')
+args = parser.parse_args()
+
+mid = mido.MidiFile(args.midi_file)
+tempo_map = TempoMap(mid)
+notes = read_notes(mid, skip_percussion=not args.percussion)
+if args.voices > 1:
+    lines = split_voices(notes, args.voices)
+    names = [f'{args.name}{i}' for i in range(args.voices)]
+else:
+    track_order = [int(t) for t in args.track_order.split(',') if t]
+    lines = [reduce_monophonic(notes, args.strategy, track_order)]
+    names = [args.name]
+
+for name, line in zip(names, lines):
+    pairs, unit_us = quantize(timed_events(line, tempo_map), args.min_unit_us)
+    if args.pairs:
+        print_pairs(pairs, unit_us)
+    else:
+        print_packed(name, pack_song(pairs, unit_us))
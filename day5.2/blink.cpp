@@ -1,4 +1,6 @@
+#include <algorithm>
 #include <array>
+#include <cmath>
 
 #include <cstdint>
 #include <cstdio>
@@ -12,6 +14,7 @@
 #include "hardware/clocks.h"
 #include "hardware/gpio.h"
 #include "hardware/pwm.h"
+#include "hardware/sync.h"
 #include "pico/stdlib.h"
 
 class Led {
@@ -37,30 +40,146 @@ private:
   const int pin_;
 };
 
+// Single producer, single consumer: an IRQ pushes and the main loop pops.
+// Each side only writes its own index, so neither has to mask interrupts,
+// and a full queue drops the new event rather than stall the IRQ. The
+// barrier publishes the item before the index that makes it visible.
+template <typename T, size_t N> class EventQueue {
+  static_assert((N & (N - 1)) == 0, "N must be a power of two");
+
+public:
+  bool push(const T &item) {
+    const uint32_t head = head_;
+    if (head - tail_ == N) {
+      dropped_ = dropped_ + 1;
+      return false;
+    }
+    items_[head % N] = item;
+    __dmb();
+    head_ = head + 1;
+    return true;
+  }
+
+  bool pop(T &item) {
+    const uint32_t tail = tail_;
+    if (tail == head_) {
+      return false;
+    }
+    item = items_[tail % N];
+    __dmb();
+    tail_ = tail + 1;
+    return true;
+  }
+
+  uint32_t dropped() const { return dropped_; }
+
+private:
+  std::array<T, N> items_ = {};
+  volatile uint32_t head_ = 0;
+  volatile uint32_t tail_ = 0;
+  volatile uint32_t dropped_ = 0;
+};
+
+// Edges come from the GPIO IRQ, stamped with time_us_64() as it runs, so no
+// press is missed however long the main loop is busy. The first edge counts
+// at once; the contacts then get debounceUs to settle before the pin is read
+// again, which catches a release that happened during the bounce.
 class Button {
 public:
-  explicit Button(int pin) : pin_(pin) {
+  enum class EventType { PRESS, RELEASE };
+
+  struct Event {
+    EventType type;
+    uint64_t timeUs;
+  };
+
+  static constexpr uint32_t kDefaultDebounceUs = 5000;
+
+  explicit Button(int pin, uint32_t debounceUs = kDefaultDebounceUs)
+      : pin_(pin), debounceUs_(debounceUs) {
     gpio_init(pin_);
     gpio_set_dir(pin_, GPIO_IN);
     gpio_pull_down(pin_);
+    pressed_ = gpio_get(pin_);
+    buttons_[pin_] = this;
+    gpio_set_irq_enabled_with_callback(pin_, kEdges, true, &Button::onGpioIrq);
   }
 
+  ~Button() {
+    gpio_set_irq_enabled(pin_, kEdges, false);
+    if (settleAlarm_ != 0) {
+      cancel_alarm(settleAlarm_);
+    }
+    buttons_[pin_] = nullptr;
+  }
+
+  Button(const Button &) = delete;
+  Button &operator=(const Button &) = delete;
+
+  // Whether the button was pressed since the last call, however briefly.
   bool is_pressed() {
-    bool state = gpio_get(pin_);
-    if (state) {
-      if (!is_pressed_) {
-        is_pressed_ = true;
-        return true;
-      }
-    } else {
-      is_pressed_ = false;
+    bool pressed = false;
+    Event event;
+    while (events_.pop(event)) {
+      pressed = pressed || event.type == EventType::PRESS;
     }
-    return false;
+    return pressed;
   }
 
+  // Presses and releases in order, for callers that need both or the time.
+  bool nextEvent(Event &event) { return events_.pop(event); }
+
+  uint32_t droppedEvents() const { return events_.dropped(); }
+
 private:
-  int pin_;
-  bool is_pressed_ = {};
+  static constexpr uint32_t kEdges = GPIO_IRQ_EDGE_RISE | GPIO_IRQ_EDGE_FALL;
+
+  // The SDK has a single GPIO callback for all pins.
+  static void onGpioIrq(uint gpio, uint32_t events) {
+    if (Button *button = buttons_[gpio]) {
+      button->onEdge(time_us_64());
+    }
+  }
+
+  void onEdge(uint64_t timeUs) {
+    lastEdgeUs_ = timeUs;
+    if (settleAlarm_ == 0 && update(timeUs)) {
+      settleAlarm_ =
+          add_alarm_in_us(debounceUs_, &Button::onSettled, this, true);
+    }
+  }
+
+  // Queues the level the pin is at now, if that is news.
+  bool update(uint64_t timeUs) {
+    const bool level = gpio_get(pin_);
+    if (level == pressed_) {
+      return false;
+    }
+    pressed_ = level;
+    events_.push({level ? EventType::PRESS : EventType::RELEASE, timeUs});
+    return true;
+  }
+
+  static int64_t onSettled(alarm_id_t, void *userData) {
+    auto *button = static_cast<Button *>(userData);
+    // It changed again while bouncing: that counts from its last edge, and
+    // gets its own time to settle.
+    if (button->update(button->lastEdgeUs_)) {
+      return button->debounceUs_;
+    }
+    button->settleAlarm_ = 0;
+    return 0;
+  }
+
+private:
+  static inline std::array<Button *, NUM_BANK0_GPIOS> buttons_ = {};
+  const int pin_;
+  const uint32_t debounceUs_;
+
+  bool pressed_ = false;
+  volatile alarm_id_t settleAlarm_ = 0;
+  volatile uint64_t lastEdgeUs_ = 0;
+  EventQueue<Event, 16> events_;
 };
 
 class Knob {
@@ -82,6 +201,176 @@ private:
 
 enum class Subdivision { QUARTERS = 1, EIGHTHS, TRIPPLETS };
 
+// Keeps time from alarm callbacks, so the beat never waits for the main
+// loop. Every pulse edge has an absolute due time worked out from where the
+// current tempo started, never from the previous edge, so neither rounding
+// nor IRQ latency adds up. Tempo and subdivision changes take effect on the
+// next beat. The handler runs in the timer IRQ; how late each edge ran is
+// measured there.
+class Metronome {
+public:
+  static constexpr int kBeatsPerBar = 4;
+
+  // Each subdivision of a beat is one pulse: on for its first half, off for
+  // the second.
+  struct Pulse {
+    int beat; // within the bar
+    int subdivision;
+    bool on;
+  };
+
+  using PulseHandler = void (*)(const Pulse &pulse, void *userData);
+
+  struct TimingError {
+    uint32_t edges;
+    uint32_t meanLateUs;
+    uint32_t maxLateUs;
+  };
+
+  Metronome(uint32_t milliBpm, int subdivisions, PulseHandler handler,
+            void *userData)
+      : handler_(handler), userData_(userData), milliBpm_(milliBpm),
+        subdivisions_(subdivisions), pendingMilliBpm_(milliBpm),
+        pendingSubdivisions_(subdivisions) {}
+
+  ~Metronome() { stop(); }
+
+  Metronome(const Metronome &) = delete;
+  Metronome &operator=(const Metronome &) = delete;
+
+  void start() {
+    stop();
+    const uint32_t status = save_and_disable_interrupts();
+    beat_ = 0;
+    subdivision_ = 0;
+    on_ = true;
+    beatInTempo_ = 0;
+    tempoStartUs_ = time_us_64() + kStartDelayUs;
+    dueUs_ = tempoStartUs_;
+    alarm_ = add_alarm_at(from_us_since_boot(dueUs_), &Metronome::onAlarm,
+                          this, true);
+    restore_interrupts(status);
+  }
+
+  void stop() {
+    if (alarm_ != 0) {
+      cancel_alarm(alarm_);
+      alarm_ = 0;
+    }
+  }
+
+  void setTempo(uint32_t milliBpm) { pendingMilliBpm_ = milliBpm; }
+  void setSubdivisions(int subdivisions) {
+    pendingSubdivisions_ = subdivisions;
+  }
+
+  uint32_t milliBpm() const { return milliBpm_; }
+  int subdivisions() const { return subdivisions_; }
+
+  TimingError timingError() const {
+    const uint32_t status = save_and_disable_interrupts();
+    const TimingError error = {
+        edges_, edges_ == 0 ? 0 : uint32_t(lateSumUs_ / edges_), maxLateUs_};
+    restore_interrupts(status);
+    return error;
+  }
+
+  void resetTimingError() {
+    const uint32_t status = save_and_disable_interrupts();
+    edges_ = 0;
+    lateSumUs_ = 0;
+    maxLateUs_ = 0;
+    restore_interrupts(status);
+  }
+
+private:
+  // Room for the first edge to be set up before it is due.
+  static constexpr uint64_t kStartDelayUs = 1000;
+
+  // Start of beat |n| counted from where the current tempo started.
+  uint64_t beatStartUs(uint64_t n) const {
+    return tempoStartUs_ + n * 60'000'000'000ull / milliBpm_;
+  }
+
+  uint64_t pulseStartUs(uint64_t n, int subdivision) const {
+    const uint64_t beatUs = beatStartUs(n + 1) - beatStartUs(n);
+    return beatStartUs(n) + beatUs * subdivision / subdivisions_;
+  }
+
+  // Due time of the edge we are at now.
+  uint64_t edgeUs() const {
+    const uint64_t startUs = pulseStartUs(beatInTempo_, subdivision_);
+    if (on_) {
+      return startUs;
+    }
+    const uint64_t endUs = subdivision_ + 1 == subdivisions_
+                               ? beatStartUs(beatInTempo_ + 1)
+                               : pulseStartUs(beatInTempo_, subdivision_ + 1);
+    return startUs + (endUs - startUs) / 2;
+  }
+
+  void nextEdge() {
+    if (on_) {
+      on_ = false;
+      return;
+    }
+    on_ = true;
+    if (++subdivision_ < subdivisions_) {
+      return;
+    }
+    subdivision_ = 0;
+    beat_ = (beat_ + 1) % kBeatsPerBar;
+    ++beatInTempo_;
+    if (pendingMilliBpm_ != milliBpm_ ||
+        pendingSubdivisions_ != subdivisions_) {
+      // The new tempo counts from this beat.
+      tempoStartUs_ = beatStartUs(beatInTempo_);
+      beatInTempo_ = 0;
+      milliBpm_ = std::max<uint32_t>(uint32_t(pendingMilliBpm_), 1);
+      subdivisions_ = std::max(int(pendingSubdivisions_), 1);
+    }
+  }
+
+  static int64_t onAlarm(alarm_id_t, void *userData) {
+    return static_cast<Metronome *>(userData)->onEdge();
+  }
+
+  int64_t onEdge() {
+    const uint64_t lateUs = time_us_64() - dueUs_;
+    ++edges_;
+    lateSumUs_ += lateUs;
+    maxLateUs_ = std::max<uint32_t>(maxLateUs_, lateUs);
+
+    handler_({beat_, subdivision_, on_}, userData_);
+    const uint64_t previousUs = dueUs_;
+    nextEdge();
+    dueUs_ = edgeUs();
+    // Negative: counted from when this alarm was due, not from now.
+    return -std::max<int64_t>(dueUs_ - previousUs, 1);
+  }
+
+private:
+  const PulseHandler handler_;
+  void *const userData_;
+
+  uint32_t milliBpm_;
+  int subdivisions_;
+  volatile uint32_t pendingMilliBpm_;
+  volatile int pendingSubdivisions_;
+
+  alarm_id_t alarm_ = 0;
+  uint64_t tempoStartUs_ = 0;
+  uint64_t beatInTempo_ = 0;
+  int beat_ = 0;
+  int subdivision_ = 0;
+  bool on_ = true;
+  uint64_t dueUs_ = 0;
+
+  uint32_t edges_ = 0;
+  uint64_t lateSumUs_ = 0;
+  uint32_t maxLateUs_ = 0;
+};
+
 class Buzzer {
 public:
   explicit Buzzer(int pin)
@@ -106,10 +395,15 @@ private:
   }
 
 public:
-  void playFrequencyFor(const float frequency, const float durationMs) {
+  // Starts |frequency| and leaves it on until off().
+  void play(const float frequency) {
     const uint16_t wrap = convertFrequencyToWrap(frequency);
     pwm_set_wrap(sliceNum_, wrap);
     pwm_set_chan_level(sliceNum_, channel_, wrap / 4);
+  }
+
+  void playFrequencyFor(const float frequency, const float durationMs) {
+    play(frequency);
     sleep_ms(durationMs);
   }
 
@@ -138,23 +432,150 @@ private:
   const float clockDivider_;
 };
 
-int main() {
-  constexpr float maxBpm = 250;
-  constexpr float minBpm = 40;
+constexpr std::array<float, 25> kNotes = {
+    261.63f, 277.18f, 293.66f, 311.13f, 329.63f, 349.23f, 369.99f,
+    392.00f, 415.30f, 440.00f, 466.16f, 493.88f, 523.25f, 554.37f,
+    587.33f, 622.25f, 659.25f, 698.46f, 739.99f, 783.99f, 830.61f,
+    880.00f, 932.33f, 987.77f, 1046.50f};
+
+// One LED per beat of the bar, lit for the first half of every pulse, while
+// the buzzer sounds: high on the bar's first beat, lower on the others and
+// lowest on the subdivisions in between.
+struct Outputs {
+  std::array<Led, Metronome::kBeatsPerBar> leds;
+  Buzzer buzzer;
+  float primaryBeat;
+  float secondaryBeat;
+  float tertiaryBeat;
+};
+
+Outputs makeOutputs() {
+  return {{Led(25), Led(21), Led(20), Led(19)},
+          Buzzer(13),
+          kNotes[12],
+          kNotes[7],
+          kNotes[0]};
+}
+
+void playPulse(const Metronome::Pulse &pulse, void *userData) {
+  auto &outputs = *static_cast<Outputs *>(userData);
+  const auto &led = outputs.leds[pulse.beat];
+  if (!pulse.on) {
+    outputs.buzzer.off();
+    led.turnOff();
+    return;
+  }
+  if (pulse.subdivision != 0) {
+    outputs.buzzer.play(outputs.tertiaryBeat);
+  } else if (pulse.beat == 0) {
+    outputs.buzzer.play(outputs.primaryBeat);
+  } else {
+    outputs.buzzer.play(outputs.secondaryBeat);
+  }
+  led.turnOn();
+}
+
+#ifdef BENCHMARK
+// How long after the previous pulse each pulse of one run started, from
+// timestamps taken in the alarm callback right after the outputs changed.
+// Intervals fit in 32 bits however long the run goes on.
+struct EdgeLog {
+  static constexpr int kMaxEdges = 9000;
+
+  Metronome::PulseHandler outputs;
+  void *outputsData;
+  std::array<uint32_t, kMaxEdges> intervalsUs;
+  uint64_t lastUs;
+  int expected;
+  volatile int count;
+};
 
-  constexpr std::array<float, 25> notes = {
-      261.63f, 277.18f, 293.66f, 311.13f, 329.63f, 349.23f, 369.99f,
-      392.00f, 415.30f, 440.00f, 466.16f, 493.88f, 523.25f, 554.37f,
-      587.33f, 622.25f, 659.25f, 698.46f, 739.99f, 783.99f, 830.61f,
-      880.00f, 932.33f, 987.77f, 1046.50f};
+void logPulse(const Metronome::Pulse &pulse, void *userData) {
+  auto &log = *static_cast<EdgeLog *>(userData);
+  log.outputs(pulse, log.outputsData);
+  if (pulse.on && log.count < log.expected) {
+    const uint64_t nowUs = time_us_64();
+    log.intervalsUs[log.count] =
+        log.count == 0 ? 0 : static_cast<uint32_t>(nowUs - log.lastUs);
+    log.lastUs = nowUs;
+    log.count = log.count + 1;
+  }
+}
+
+// Plays |kBeats| beats and compares every pulse with an ideal grid that
+// starts at the first one: the mean drift of a pulse interval, the 99th
+// percentile of how far an interval strays from the ideal, where the last
+// pulse ended up (the cumulative error) and the furthest any pulse got.
+void benchmarkTiming(EdgeLog &log, uint32_t bpm, Subdivision mode) {
+  constexpr int kBeats = 3000;
+  static_assert(kBeats * static_cast<int>(Subdivision::TRIPPLETS) <=
+                    EdgeLog::kMaxEdges,
+                "the log holds every pulse of the longest run");
+
+  const int subdivisions = static_cast<int>(mode);
+  const int edges = kBeats * subdivisions;
+  log.expected = edges;
+  log.count = 0;
+  Metronome metronome(1000 * bpm, subdivisions, logPulse, &log);
+  metronome.start();
+  while (log.count < edges) {
+    __wfe();
+  }
+  metronome.stop();
+  for (int beat = 0; beat < Metronome::kBeatsPerBar; ++beat) {
+    log.outputs({beat, 0, false}, log.outputsData);
+  }
 
-  const float primaryBeat = notes[12];
-  const float secondaryBeat = notes[7];
-  const float tertiaryBeat = notes[0];
+  // The elapsed time adds up exactly in whole microseconds. Each interval is
+  // then replaced by its jitter in nanoseconds, for the percentile.
+  const double periodUs = 60e6 / bpm / subdivisions;
+  uint64_t elapsedUs = 0;
+  double worstUs = 0;
+  for (int i = 1; i < edges; ++i) {
+    const uint32_t intervalUs = log.intervalsUs[i];
+    elapsedUs += intervalUs;
+    worstUs = std::max(worstUs, std::fabs(elapsedUs - i * periodUs));
+    log.intervalsUs[i] =
+        static_cast<uint32_t>(std::fabs(intervalUs - periodUs) * 1000 + 0.5);
+  }
+  const double cumulativeUs = elapsedUs - (edges - 1) * periodUs;
+  const auto jitterNs = log.intervalsUs.begin() + 1;
+  const auto p99 = jitterNs + (edges - 1) * 99 / 100;
+  std::nth_element(jitterNs, p99, jitterNs + edges - 1);
+
+  printf("%3u bpm x%d: %4d pulses, drift %+7.3f us/pulse, p99 jitter %6.1f "
+         "us, cumulative %+8.1f us, worst %6.1f us\n",
+         unsigned(bpm), subdivisions, edges, cumulativeUs / (edges - 1),
+         *p99 / 1000.0, cumulativeUs, worstUs);
+}
 
+// Sweeps the tempo range in every subdivision; it keeps real time, so this
+// takes about ten hours. On the host, set PICO_HOST_RUN_MS=0 to let it finish,
+// and PICO_HOST_CLOCK=hybrid to have host scheduling show up as jitter.
+int main() {
   stdio_init_all();
 
-  std::array<Led, 4> leds = {Led(25), Led(21), Led(20), Led(19)};
+  static EdgeLog log;
+  Outputs outputs = makeOutputs();
+  log.outputs = playPulse;
+  log.outputsData = &outputs;
+  sleep_ms(5000);
+
+  for (uint32_t bpm : {40, 70, 100, 150, 200, 250}) {
+    for (auto mode : {Subdivision::QUARTERS, Subdivision::EIGHTHS,
+                      Subdivision::TRIPPLETS}) {
+      benchmarkTiming(log, bpm, mode);
+    }
+  }
+
+  return 0;
+}
+#else
+int main() {
+  constexpr float maxBpm = 250;
+  constexpr float minBpm = 40;
+
+  stdio_init_all();
 
   Button b1(2);
   Button b2(3);
@@ -162,10 +583,15 @@ int main() {
 
   Knob knob(26, 0);
 
-  Buzzer buzzer(13);
-
   auto mode = Subdivision::QUARTERS;
 
+  Outputs outputs = makeOutputs();
+  Metronome metronome(1000 * minBpm, static_cast<int>(mode), playPulse,
+                      &outputs);
+  metronome.start();
+
+  // The metronome keeps time on its own; this loop only passes on changes.
+  uint32_t loops = 0;
   while (1) {
     if (b1.is_pressed()) {
       mode = Subdivision::QUARTERS;
@@ -178,35 +604,20 @@ int main() {
     }
 
     const float bpm = (maxBpm - minBpm) * knob.read() + minBpm;
-
-    int repeats = static_cast<int>(mode);
-    printf("mode = %d\n", repeats);
-    printf("bpm = %f\n", bpm);
-
-    const float duration = 1000 * (60 / (bpm * repeats)); // in ms
-
-    float frequency = primaryBeat;
-    for (int i = 0; i < leds.size(); ++i) {
-      for (int r = 0; r < repeats; ++r) {
-        if (r == 0) {
-          if (i == 0) {
-            frequency = primaryBeat;
-          } else {
-            frequency = secondaryBeat;
-          }
-        } else {
-          frequency = tertiaryBeat;
-        }
-
-        const auto &led = leds[i];
-        led.turnOn();
-        buzzer.playFrequencyFor(frequency, duration / 2);
-        buzzer.off();
-        led.turnOff();
-        sleep_ms(duration / 2);
-      }
+    metronome.setTempo(1000 * static_cast<uint32_t>(bpm + 0.5f));
+    metronome.setSubdivisions(static_cast<int>(mode));
+
+    if (++loops % 250 == 0) {
+      const auto error = metronome.timingError();
+      printf("mode = %d, bpm = %u\n", metronome.subdivisions(),
+             unsigned(metronome.milliBpm() / 1000));
+      printf("%u edges, late by %u us on average, %u us at most\n",
+             unsigned(error.edges), unsigned(error.meanLateUs),
+             unsigned(error.maxLateUs));
     }
+    sleep_ms(20);
   }
 
   return 0;
 }
+#endif
@@ -12,9 +12,123 @@
 #include "hardware/adc.h"
 #include "hardware/clocks.h"
 #include "hardware/gpio.h"
+#include "hardware/irq.h"
 #include "hardware/pwm.h"
+#include "hardware/sync.h"
 #include "pico/stdlib.h"
 
+// Logging. Everything below LOG_LEVEL compiles to nothing, arguments included.
+// Hot paths (the PIR edge IRQ) use TRACE instead of printf: it stores an 8-byte
+// record in a RAM ring and returns, and the records are only formatted and
+// printed by drainTrace(), which the main loop calls when it has time to spare.
+#define LOG_LEVEL_NONE 0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_INFO 2
+#define LOG_LEVEL_DEBUG 3
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_ERROR
+#define LOG_ERROR(...) printf(__VA_ARGS__)
+#else
+#define LOG_ERROR(...) ((void)0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_INFO
+#define LOG_INFO(...) printf(__VA_ARGS__)
+#else
+#define LOG_INFO(...) ((void)0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(...) printf(__VA_ARGS__)
+#define TRACE(event, arg) traceRing.record(TraceEvent::event, arg)
+#else
+#define LOG_DEBUG(...) ((void)0)
+#define TRACE(event, arg) ((void)0)
+#endif
+
+enum class TraceEvent : uint16_t {
+  MotionEdge,
+};
+
+const char *traceEventName(TraceEvent event) {
+  switch (event) {
+  case TraceEvent::MotionEdge:
+    return "motion edge";
+  }
+  return "?";
+}
+
+struct TraceRecord {
+  uint32_t timeUs;
+  TraceEvent event;
+  uint16_t arg;
+};
+
+// record() masks interrupts for the few instructions it needs, so IRQ
+// handlers and main code can both trace; drain() is lock-free but must only
+// be called from one place at a time. When full, new records are dropped and
+// counted rather than blocking the producer.
+template <size_t N> class TraceRing {
+  static_assert((N & (N - 1)) == 0, "N must be a power of two");
+
+public:
+  void record(TraceEvent event, uint16_t arg) {
+    const uint32_t status = save_and_disable_interrupts();
+    const uint32_t head = head_;
+    if (head - tail_ == N) {
+      ++dropped_;
+    } else {
+      records_[head & (N - 1)] = {time_us_32(), event, arg};
+      __dmb();
+      head_ = head + 1;
+    }
+    restore_interrupts(status);
+  }
+
+  template <typename F> size_t drain(F &&consume) {
+    size_t drained = 0;
+    while (tail_ != head_) {
+      const TraceRecord record = records_[tail_ & (N - 1)];
+      __dmb();
+      tail_ = tail_ + 1;
+      consume(record);
+      ++drained;
+    }
+    return drained;
+  }
+
+  uint32_t dropped() const { return dropped_; }
+
+private:
+  std::array<TraceRecord, N> records_;
+  volatile uint32_t head_ = 0;
+  volatile uint32_t tail_ = 0;
+  volatile uint32_t dropped_ = 0;
+};
+
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+TraceRing<256> traceRing;
+
+void drainTrace() {
+  static uint32_t reportedDrops = 0;
+  traceRing.drain([](const TraceRecord &record) {
+    printf("%10lu %-14s 0x%04X\n", static_cast<unsigned long>(record.timeUs),
+           traceEventName(record.event), record.arg);
+  });
+  if (traceRing.dropped() != reportedDrops) {
+    printf("%lu trace records dropped\n",
+           static_cast<unsigned long>(traceRing.dropped() - reportedDrops));
+    reportedDrops = traceRing.dropped();
+  }
+}
+#else
+void drainTrace() {}
+#endif
+
 class Led {
 public:
   explicit Led(int pin) : pin_(pin) {
@@ -64,24 +178,148 @@ private:
   bool is_pressed_ = {};
 };
 
+// Single producer, single consumer: an IRQ pushes and the main loop pops.
+// Each side only writes its own index, so neither has to mask interrupts,
+// and a full queue drops the new event rather than stall the IRQ. Same
+// scheme as TraceRing: the barrier publishes the item before the index.
+template <typename T, size_t N> class EventQueue {
+  static_assert((N & (N - 1)) == 0, "N must be a power of two");
+
+public:
+  bool push(const T &item) {
+    const uint32_t head = head_;
+    if (head - tail_ == N) {
+      dropped_ = dropped_ + 1;
+      return false;
+    }
+    items_[head % N] = item;
+    __dmb();
+    head_ = head + 1;
+    return true;
+  }
+
+  bool pop(T &item) {
+    const uint32_t tail = tail_;
+    if (tail == head_) {
+      return false;
+    }
+    item = items_[tail % N];
+    __dmb();
+    tail_ = tail + 1;
+    return true;
+  }
+
+  uint32_t dropped() const { return dropped_; }
+
+private:
+  std::array<T, N> items_ = {};
+  volatile uint32_t head_ = 0;
+  volatile uint32_t tail_ = 0;
+  volatile uint32_t dropped_ = 0;
+};
+
+// The sensor's output is high while it sees motion. Its edges arrive on a
+// raw GPIO IRQ handler, so other pins keep their own callback, and are
+// queued with time_us_64() from the IRQ. The output means nothing until
+// the sensor has warmed up: an alarm enables the IRQ at warmUpDoneUs(), and
+// reports motion that is already going on by then as starting there.
 class PassiveInfraRedSensor {
 public:
-  explicit PassiveInfraRedSensor(int pin) : pin_(pin) {
+  enum class EventType { MOTION_START, MOTION_END };
+
+  struct Event {
+    EventType type;
+    uint64_t timeUs;
+  };
+
+  static constexpr uint32_t kWarmUpMs = 10'000;
+
+  explicit PassiveInfraRedSensor(int pin)
+      : pin_(pin), warmUpDoneUs_(time_us_64() + kWarmUpMs * 1000ull) {
     gpio_init(pin_);
     gpio_set_dir(pin_, GPIO_IN);
     gpio_pull_down(pin_);
-    printf("Starting PIR warm up...\n");
-    sleep_ms(10'000); // Warm up
-    printf("PIR warm up finished\n");
+    instance_ = this;
+    gpio_add_raw_irq_handler(pin_, &PassiveInfraRedSensor::onGpioIrq);
+    irq_set_enabled(IO_IRQ_BANK0, true);
+    warmUpAlarm_ = add_alarm_at(from_us_since_boot(warmUpDoneUs_),
+                                &PassiveInfraRedSensor::onWarmedUp, this, true);
   }
 
-  bool hasDetection() const {
-    const bool state = gpio_get(pin_);
-    return state;
+  ~PassiveInfraRedSensor() {
+    if (warmUpAlarm_ != 0) {
+      cancel_alarm(warmUpAlarm_);
+    }
+    gpio_set_irq_enabled(pin_, kEdges, false);
+    gpio_remove_raw_irq_handler(pin_, &PassiveInfraRedSensor::onGpioIrq);
+    instance_ = nullptr;
   }
 
+  PassiveInfraRedSensor(const PassiveInfraRedSensor &) = delete;
+  PassiveInfraRedSensor &operator=(const PassiveInfraRedSensor &) = delete;
+
+  bool isWarmedUp() const { return warmedUp_; }
+  uint64_t warmUpDoneUs() const { return warmUpDoneUs_; }
+
+  bool hasDetection() const { return warmedUp_ && gpio_get(pin_); }
+
+  bool nextEvent(Event &event) { return events_.pop(event); }
+  uint32_t droppedEvents() const { return events_.dropped(); }
+
 private:
-  int pin_;
+  static constexpr uint32_t kEdges = GPIO_IRQ_EDGE_RISE | GPIO_IRQ_EDGE_FALL;
+
+  static int64_t onWarmedUp(alarm_id_t, void *userData) {
+    auto &sensor = *static_cast<PassiveInfraRedSensor *>(userData);
+    sensor.warmUpAlarm_ = 0;
+    // Whatever the output did while warming up is noise.
+    gpio_acknowledge_irq(sensor.pin_, kEdges);
+    gpio_set_irq_enabled(sensor.pin_, kEdges, true);
+    sensor.warmedUp_ = true;
+    sensor.onEdge(0);
+    return 0;
+  }
+
+  static void onGpioIrq() {
+    if (instance_ == nullptr) {
+      return;
+    }
+    const uint32_t events = gpio_get_irq_event_mask(instance_->pin_) & kEdges;
+    if (events == 0) {
+      return;
+    }
+    gpio_acknowledge_irq(instance_->pin_, events);
+    instance_->onEdge(events);
+  }
+
+  // The level says where the output is now. Both edges at once with the
+  // level unchanged is a pulse shorter than the IRQ latency, kept as one.
+  void onEdge(uint32_t events) {
+    const uint64_t nowUs = time_us_64();
+    const bool level = gpio_get(pin_);
+    TRACE(MotionEdge, level);
+    if (events == kEdges && level == motion_) {
+      push(!motion_, nowUs);
+    }
+    if (level != motion_) {
+      push(level, nowUs);
+    }
+  }
+
+  void push(bool motion, uint64_t timeUs) {
+    motion_ = motion;
+    events_.push(
+        {motion ? EventType::MOTION_START : EventType::MOTION_END, timeUs});
+  }
+
+private:
+  static inline PassiveInfraRedSensor *instance_ = nullptr;
+  const int pin_;
+  const uint64_t warmUpDoneUs_;
+  alarm_id_t warmUpAlarm_ = 0;
+  volatile bool warmedUp_ = false;
+  bool motion_ = false;
+  EventQueue<Event, 16> events_;
 };
 
 class AdcReader {
@@ -173,22 +411,39 @@ int main() {
       587.33f, 622.25f, 659.25f, 698.46f, 739.99f, 783.99f, 830.61f,
       880.00f, 932.33f, 987.77f, 1046.50f};
 
+  LOG_INFO("Starting PIR warm up...\n");
+  bool warmUpReported = false;
+
+  // Everything happens in IRQs; the CPU sleeps until one of them fires.
+  PassiveInfraRedSensor::Event event;
+  uint64_t motionStartUs = 0;
   while (1) {
-    if (pir.hasDetection()) {
-      printf("Movement detected!\n");
-      for (const auto &led : leds) {
-        led.turnOn();
-      }
-      buzzer.playFrequencyFor(notes[5], 100);
-      for (const auto &led : leds) {
-        led.turnOff();
+    if (!warmUpReported && pir.isWarmedUp()) {
+      LOG_INFO("PIR warm up finished\n");
+      warmUpReported = true;
+    }
+    while (pir.nextEvent(event)) {
+      if (event.type == PassiveInfraRedSensor::EventType::MOTION_START) {
+        LOG_INFO("Movement detected at %llu ms\n",
+                 static_cast<unsigned long long>(event.timeUs / 1000));
+        motionStartUs = event.timeUs;
+        for (const auto &led : leds) {
+          led.turnOn();
+        }
+        buzzer.playFrequencyFor(notes[5], 100);
+        buzzer.playFrequencyFor(notes[0], 100);
+        buzzer.off();
+      } else {
+        LOG_INFO("Movement stopped after %llu ms\n",
+                 static_cast<unsigned long long>(
+                     (event.timeUs - motionStartUs) / 1000));
+        for (const auto &led : leds) {
+          led.turnOff();
+        }
       }
-      buzzer.playFrequencyFor(notes[0], 100);
-      buzzer.off();
-    } else {
-      printf("No movement!\n");
     }
-    sleep_ms(10);
+    drainTrace();
+    __wfe();
   }
   return 0;
 }
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <array>
 #include <cerrno>
 #include <cstddef>
@@ -16,10 +17,143 @@
 
 #include "hardware/adc.h"
 #include "hardware/clocks.h"
+#include "hardware/dma.h"
 #include "hardware/gpio.h"
+#include "hardware/pio.h"
 #include "hardware/pwm.h"
+#include "hardware/sync.h"
 #include "pico/stdlib.h"
 
+#include "onewire.pio.h"
+
+// Logging. Everything below LOG_LEVEL compiles to nothing, arguments included.
+// Hot paths (1-wire slots, the conversion alarm) use TRACE instead of printf:
+// it stores an 8-byte record in a RAM ring and returns, and the records are
+// only formatted and printed by drainTrace(), which the main loop calls when it
+// has time to spare.
+#define LOG_LEVEL_NONE 0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_INFO 2
+#define LOG_LEVEL_DEBUG 3
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_ERROR
+#define LOG_ERROR(...) printf(__VA_ARGS__)
+#else
+#define LOG_ERROR(...) ((void)0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_INFO
+#define LOG_INFO(...) printf(__VA_ARGS__)
+#else
+#define LOG_INFO(...) ((void)0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(...) printf(__VA_ARGS__)
+#define TRACE(event, arg) traceRing.record(TraceEvent::event, arg)
+#else
+#define LOG_DEBUG(...) ((void)0)
+#define TRACE(event, arg) ((void)0)
+#endif
+
+enum class TraceEvent : uint16_t {
+  OneWireReset,
+  OneWireWrite,
+  OneWireRead,
+  ConversionStarted,
+  ConversionFinished,
+  CrcError,
+};
+
+const char *traceEventName(TraceEvent event) {
+  switch (event) {
+  case TraceEvent::OneWireReset:
+    return "1-wire reset";
+  case TraceEvent::OneWireWrite:
+    return "1-wire write";
+  case TraceEvent::OneWireRead:
+    return "1-wire read";
+  case TraceEvent::ConversionStarted:
+    return "convert start";
+  case TraceEvent::ConversionFinished:
+    return "convert done";
+  case TraceEvent::CrcError:
+    return "CRC error";
+  }
+  return "?";
+}
+
+struct TraceRecord {
+  uint32_t timeUs;
+  TraceEvent event;
+  uint16_t arg;
+};
+
+// record() masks interrupts for the few instructions it needs, so IRQ
+// handlers and main code can both trace; drain() is lock-free but must only
+// be called from one place at a time. When full, new records are dropped and
+// counted rather than blocking the producer.
+template <size_t N> class TraceRing {
+  static_assert((N & (N - 1)) == 0, "N must be a power of two");
+
+public:
+  void record(TraceEvent event, uint16_t arg) {
+    const uint32_t status = save_and_disable_interrupts();
+    const uint32_t head = head_;
+    if (head - tail_ == N) {
+      ++dropped_;
+    } else {
+      records_[head & (N - 1)] = {time_us_32(), event, arg};
+      __dmb();
+      head_ = head + 1;
+    }
+    restore_interrupts(status);
+  }
+
+  template <typename F> size_t drain(F &&consume) {
+    size_t drained = 0;
+    while (tail_ != head_) {
+      const TraceRecord record = records_[tail_ & (N - 1)];
+      __dmb();
+      tail_ = tail_ + 1;
+      consume(record);
+      ++drained;
+    }
+    return drained;
+  }
+
+  uint32_t dropped() const { return dropped_; }
+
+private:
+  std::array<TraceRecord, N> records_;
+  volatile uint32_t head_ = 0;
+  volatile uint32_t tail_ = 0;
+  volatile uint32_t dropped_ = 0;
+};
+
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+TraceRing<256> traceRing;
+
+void drainTrace() {
+  static uint32_t reportedDrops = 0;
+  traceRing.drain([](const TraceRecord &record) {
+    printf("%10lu %-14s 0x%04X\n", static_cast<unsigned long>(record.timeUs),
+           traceEventName(record.event), record.arg);
+  });
+  if (traceRing.dropped() != reportedDrops) {
+    printf("%lu trace records dropped\n",
+           static_cast<unsigned long>(traceRing.dropped() - reportedDrops));
+    reportedDrops = traceRing.dropped();
+  }
+}
+#else
+void drainTrace() {}
+#endif
+
 class Led {
 public:
   explicit Led(int pin) : pin_(pin) {
@@ -75,9 +209,9 @@ public:
     gpio_init(pin_);
     gpio_set_dir(pin_, GPIO_IN);
     gpio_pull_down(pin_);
-    printf("Starting PIR warm up...\n");
+    LOG_INFO("Starting PIR warm up...\n");
     sleep_ms(10'000); // Warm up
-    printf("PIR warm up finished\n");
+    LOG_INFO("PIR warm up finished\n");
   }
 
   bool hasDetection() const {
@@ -164,130 +298,450 @@ private:
   const float clockDivider_;
 };
 
+// Dallas/Maxim CRC8 (x^8 + x^5 + x^4 + 1, reflected), one table lookup per
+// byte. Running it over data that ends in its own CRC gives 0.
+constexpr std::array<uint8_t, 256> makeCrc8Table() {
+  std::array<uint8_t, 256> table = {};
+  for (int i = 0; i < 256; ++i) {
+    uint8_t crc = i;
+    for (int bit = 0; bit < 8; ++bit) {
+      crc = (crc & 1) ? (crc >> 1) ^ 0x8C : crc >> 1;
+    }
+    table[i] = crc;
+  }
+  return table;
+}
+
+constexpr std::array<uint8_t, 256> kCrc8Table = makeCrc8Table();
+
+uint8_t crc8(const uint8_t *data, size_t size) {
+  uint8_t crc = 0;
+  for (size_t i = 0; i < size; ++i) {
+    crc = kCrc8Table[crc ^ data[i]];
+  }
+  return crc;
+}
+
+// All DS18B20s on one 1-wire pin. The bus timing comes from the onewire PIO
+// program, and DMA moves the bytes in and out of it, so an interrupt can no
+// longer stretch a slot and the CPU sleeps through the transfers instead of
+// bit-banging them. One broadcast conversion serves every sensor; readings
+// are then collected one sensor at a time by ROM code.
 class DS18B20 {
 public:
-  explicit DS18B20(int pin) : pin_(pin) {}
+  explicit DS18B20(int pin) : pin_(pin) {
+    bool success = pio_claim_free_sm_and_add_program_for_gpio_range(
+        &onewire_program, &pio_, &sm_, &offset_, pin_, 1, true);
+    hard_assert(success);
 
-  std::optional<float> getTemperature() {
-    if (!initialize()) {
+    onewire_program_init(pio_, sm_, offset_, pin_);
+    setupDma();
+  }
+
+  ~DS18B20() {
+    if (state_ == State::Converting) {
+      cancel_alarm(alarm_);
+    }
+    dma_channel_unclaim(txDma_);
+    dma_channel_unclaim(rxDma_);
+    pio_remove_program_and_unclaim_sm(&onewire_program, pio_, sm_, offset_);
+  }
+
+  enum class Status {
+    Ok,
+    Busy,       // A conversion is still running.
+    NotStarted, // readResult() without a finished startConversion().
+    NoDevice,   // Nobody answered the reset pulse.
+    Timeout,    // The conversion never reported done.
+    CrcError,   // Every attempt read back a corrupted scratchpad.
+  };
+
+  static const char *describe(Status status) {
+    switch (status) {
+    case Status::Ok:
+      return "ok";
+    case Status::Busy:
+      return "busy";
+    case Status::NotStarted:
+      return "not started";
+    case Status::NoDevice:
+      return "no device";
+    case Status::Timeout:
+      return "timeout";
+    case Status::CrcError:
+      return "CRC error";
+    }
+    return "?";
+  }
+
+  // Starts a conversion and returns right away. An alarm then polls the
+  // sensor in the background until conversionDone(), which takes up to
+  // 750 ms at 12 bits; collect the reading with readResult().
+  Status startConversion() {
+    if (state_ == State::Converting) {
+      return Status::Busy;
+    }
+    state_ = State::Idle;
+    if (!reset()) {
+      return Status::NoDevice;
+    }
+    std::array<uint8_t, 2> convert = {SKIP_ROM, CONVERT_T};
+    transfer(convert);
+    TRACE(ConversionStarted, 0);
+
+    deadline_ = make_timeout_time_ms(kMaxConversionMs);
+    pollPending_ = false;
+    state_ = State::Converting;
+    alarm_ = add_alarm_in_ms(kPollIntervalMs, onAlarm, this, true);
+    return Status::Ok;
+  }
+
+  bool conversionDone() const { return state_ != State::Converting; }
+
+  // Result of the last conversion from the only sensor on the bus.
+  Status readResult(float &celsius) {
+    return readResult(nullptr, celsius);
+  }
+
+  // Result of the last conversion from sensor |index| of searchSensors().
+  Status readResult(size_t index, float &celsius) {
+    if (index >= numSensors_) {
+      return Status::NoDevice;
+    }
+    return readResult(&roms_[index], celsius);
+  }
+
+  // With the check on (the default), scratchpad and ROM reads that fail the
+  // CRC are retried up to |maxRetries| times, waiting |backoffUs| before
+  // the first retry and twice as long before each one after. With it off,
+  // reads stop after the two temperature bytes, which saves 7 of the 9
+  // scratchpad bytes on the bus; the reset that starts the next command
+  // cuts the sensor short.
+  void setCrcCheck(bool enabled) { checkCrc_ = enabled; }
+  void setRetries(int maxRetries, uint32_t backoffUs) {
+    maxRetries_ = maxRetries;
+    retryBackoffUs_ = backoffUs;
+  }
+
+  uint32_t crcFailures() const { return crcFailures_; }
+  uint32_t retries() const { return retries_; }
+
+  // Finds every device on the bus with SEARCH ROM and remembers their ROM
+  // codes, up to kMaxSensors. Returns how many were found.
+  size_t searchSensors() {
+    if (state_ == State::Converting) {
+      return 0;
+    }
+    for (int attempt = 0;; ++attempt) {
+      if (searchAll()) {
+        return numSensors_;
+      }
+      if (!retryAfter(attempt)) {
+        numSensors_ = 0;
+        return 0;
+      }
+    }
+  }
+
+  size_t numSensors() const { return numSensors_; }
+  uint64_t rom(size_t index) const { return roms_[index]; }
+
+  // ROM code of the only device on the bus; garbage if there are several.
+  std::optional<uint64_t> readRom() {
+    if (state_ == State::Converting) {
       return {};
     }
-    // printf("rom: %llu\n", readRom());
-    skipRom();
-
-    // Convert T
-    constexpr uint8_t CONVERT_T = 0x44;
-    printf("Converting temperature started\n");
-    writeByte(CONVERT_T);
-    while (!readBit()) {
+    for (int attempt = 0;; ++attempt) {
+      if (!reset()) {
+        return {};
+      }
+      std::array<uint8_t, 9> frame = {READ_ROM};
+      std::fill(frame.begin() + 1, frame.end(), 0xFF);
+      transfer(frame);
+      if (crcMatches(frame.data() + 1, 8)) {
+        uint64_t rom = 0;
+        for (int i = 0; i < 8; ++i) {
+          rom |= uint64_t(frame[1 + i]) << (8 * i);
+        }
+        return rom;
+      }
+      if (!retryAfter(attempt)) {
+        return {};
+      }
     }
-    printf("Converting temperature finished\n");
+  }
 
-    if (!initialize()) {
+  // Blocking convenience wrapper around the calls above.
+  std::optional<float> getTemperature() {
+    if (startConversion() != Status::Ok) {
       return {};
     }
-    // printf("rom: %llu\n", readRom());
-    skipRom();
-    // Read scratchpad
-    printf("Reading temperature\n");
-    constexpr uint8_t READ_SCRATCHPAD = 0xBE;
-    writeByte(READ_SCRATCHPAD);
-    std::array<uint8_t, 9> scratchpad{0};
-    readBytes(scratchpad);
-
-    printf("scratchpad:\n");
-    for (const auto &byte : scratchpad) {
-      printf("%d\n", byte);
+    while (!conversionDone()) {
+      sleep_ms(kPollIntervalMs);
     }
-    return decodeTemperature(scratchpad[0], scratchpad[1]);
+    float celsius;
+    if (readResult(celsius) != Status::Ok) {
+      return {};
+    }
+    return celsius;
   }
 
-private:
-  bool initialize() {
-    printf("Initializing\n");
-    gpio_init(pin_);
+  static constexpr size_t kMaxSensors = 8;
 
-    // Reset pulse
-    printf("Reset pulse\n");
-    gpio_set_dir(pin_, GPIO_OUT);
-    gpio_put(pin_, 0);
-    sleep_us(480);
+private:
+  static constexpr uint8_t READ_ROM = 0x33;
+  static constexpr uint8_t MATCH_ROM = 0x55;
+  static constexpr uint8_t SKIP_ROM = 0xCC;
+  static constexpr uint8_t SEARCH_ROM = 0xF0;
+  static constexpr uint8_t CONVERT_T = 0x44;
+  static constexpr uint8_t READ_SCRATCHPAD = 0xBE;
+
+  static constexpr int kSearchFailed = -2;
+
+  static constexpr uint32_t kMaxConversionMs = 1000;
+  static constexpr uint32_t kPollIntervalMs = 10;
+  // 8 slots of 66 us, see onewire.pio.
+  static constexpr uint32_t kByteUs = 8 * 66;
+  // A poll byte is read back well within this.
+  static constexpr uint32_t kPollAnswerUs = kByteUs + 100;
+
+  enum class State : uint8_t { Idle, Converting, Ready, TimedOut };
+
+  // Readings stay available until the next startConversion().
+  Status resultStatus() const {
+    switch (state_) {
+    case State::Converting:
+      return Status::Busy;
+    case State::TimedOut:
+      return Status::Timeout;
+    case State::Ready:
+      return Status::Ok;
+    default:
+      return Status::NotStarted;
+    }
+  }
 
-    // Check for response
-    gpio_set_dir(pin_, GPIO_IN);
-    sleep_us(60);
-    const bool isPresent = (gpio_get(pin_) == 0);
-    sleep_us(240);
-    const bool wasReleased = (gpio_get(pin_) == 1);
-    sleep_us(240);
-    printf("isPresent = %d, wasReleased = %d\n", isPresent, wasReleased);
-    return isPresent && wasReleased;
+  Status readResult(const uint64_t *rom, float &celsius) {
+    const Status status = resultStatus();
+    if (status != Status::Ok) {
+      return status;
+    }
+    for (int attempt = 0;; ++attempt) {
+      std::array<uint8_t, 9> scratchpad;
+      const Status read = readScratchpad(rom, scratchpad);
+      if (read == Status::Ok) {
+        celsius = decodeTemperature(scratchpad[0], scratchpad[1]);
+        return Status::Ok;
+      }
+      if (read != Status::CrcError || !retryAfter(attempt)) {
+        return read;
+      }
+    }
   }
 
-  void writeBit(bool bit) {
-    gpio_set_dir(pin_, GPIO_OUT);
-    if (bit) {
-      gpio_put(pin_, 0);
-      sleep_us(5);
-      gpio_set_dir(pin_, GPIO_IN);
-      sleep_us(55);
+  // One READ SCRATCHPAD, addressed to |rom| or, if null, to whoever is on
+  // the bus. Without the CRC check only the first two bytes are filled in.
+  Status readScratchpad(const uint64_t *rom,
+                        std::array<uint8_t, 9> &scratchpad) {
+    if (!reset()) {
+      return Status::NoDevice;
+    }
+    std::array<uint8_t, 19> frame;
+    size_t size = 0;
+    if (rom != nullptr) {
+      frame[size++] = MATCH_ROM;
+      for (int i = 0; i < 8; ++i) {
+        frame[size++] = *rom >> (8 * i);
+      }
     } else {
-      gpio_put(pin_, 0);
-      sleep_us(60);
-      gpio_set_dir(pin_, GPIO_IN);
-      sleep_us(10);
+      frame[size++] = SKIP_ROM;
     }
+    frame[size++] = READ_SCRATCHPAD;
+    const size_t data = size;
+    const size_t dataSize = checkCrc_ ? scratchpad.size() : 2;
+    std::fill_n(frame.begin() + data, dataSize, 0xFF);
+    size += dataSize;
+    transfer(frame.data(), size);
+    std::copy_n(frame.begin() + data, dataSize, scratchpad.begin());
+    if (checkCrc_ && !crcMatches(scratchpad.data(), scratchpad.size())) {
+      return Status::CrcError;
+    }
+    return Status::Ok;
   }
 
-  bool readBit() {
-    gpio_set_dir(pin_, GPIO_OUT);
-    gpio_put(pin_, 0);
-    sleep_us(5);
+  // |data| ends in its CRC8. Always true with the check off.
+  bool crcMatches(const uint8_t *data, size_t size) {
+    if (!checkCrc_ || crc8(data, size) == 0) {
+      return true;
+    }
+    ++crcFailures_;
+    TRACE(CrcError, data[size - 1]);
+    return false;
+  }
 
-    gpio_set_dir(pin_, GPIO_IN);
-    sleep_us(10);
-    const bool bit = gpio_get(pin_);
-    sleep_us(55);
+  // Waits out the backoff before retry |attempt| + 1, or returns false if
+  // that would be one too many.
+  bool retryAfter(int attempt) {
+    if (attempt >= maxRetries_) {
+      return false;
+    }
+    ++retries_;
+    sleep_us(retryBackoffUs_ << attempt);
+    return true;
+  }
 
-    return bit;
+  // Searches the whole ROM tree once. False if a ROM code came back
+  // corrupted, or a branch that was there on the last pass went quiet; the
+  // table then holds whatever was found before it.
+  bool searchAll() {
+    numSensors_ = 0;
+    int lastDiscrepancy = -1;
+    uint64_t rom = 0;
+    do {
+      const int discrepancy = searchNext(lastDiscrepancy, rom);
+      if (discrepancy == kSearchFailed) {
+        return numSensors_ == 0;
+      }
+      uint8_t bytes[8];
+      for (int i = 0; i < 8; ++i) {
+        bytes[i] = rom >> (8 * i);
+      }
+      if (!crcMatches(bytes, sizeof(bytes))) {
+        return false;
+      }
+      roms_[numSensors_++] = rom;
+      lastDiscrepancy = discrepancy;
+    } while (lastDiscrepancy >= 0 && numSensors_ < kMaxSensors);
+    return true;
   }
 
-  void writeByte(uint8_t byte) {
-    printf("Writing byte: %02X\n", byte);
-    for (int i = 0; i < 8; ++i) {
-      writeBit(byte & 1);
-      byte >>= 1;
+  // One pass of the ROM search (Maxim AN187): at every bit where devices
+  // disagree, takes the 1 branch at |lastDiscrepancy|, repeats the previous
+  // choice before it and the 0 branch after it. Leaves the ROM found in
+  // |rom| and returns the new last discrepancy (-1 once the tree is
+  // exhausted), or kSearchFailed if nobody answered.
+  int searchNext(int lastDiscrepancy, uint64_t &rom) {
+    if (!reset()) {
+      return kSearchFailed;
     }
+    writeByte(SEARCH_ROM);
+    onewire_set_bits_per_word(pio_, sm_, offset_, pin_, 1);
+    int discrepancy = -1;
+    bool failed = false;
+    for (int bit = 0; bit < 64; ++bit) {
+      const bool idBit = slot(1);
+      const bool complementBit = slot(1);
+      bool direction;
+      if (idBit && complementBit) {
+        failed = true;
+        break;
+      } else if (idBit != complementBit) {
+        direction = idBit;
+      } else if (bit < lastDiscrepancy) {
+        direction = (rom >> bit) & 1;
+      } else {
+        direction = bit == lastDiscrepancy;
+      }
+      if (idBit == complementBit && !direction) {
+        discrepancy = bit;
+      }
+      rom = (rom & ~(uint64_t(1) << bit)) | (uint64_t(direction) << bit);
+      slot(direction);
+    }
+    onewire_set_bits_per_word(pio_, sm_, offset_, pin_, 8);
+    return failed ? kSearchFailed : discrepancy;
+  }
+
+  // A single slot; only between onewire_set_bits_per_word(..., 1) and
+  // (..., 8).
+  bool slot(bool bit) {
+    pio_sm_put_blocking(pio_, sm_, bit);
+    return pio_sm_get_blocking(pio_, sm_) >> 31;
+  }
+
+  static int64_t onAlarm(alarm_id_t id, void *userData) {
+    return static_cast<DS18B20 *>(userData)->pollConversion();
   }
 
-  uint8_t readByte() {
-    uint8_t byte = 0;
-    for (int i = 0; i < 8; ++i) {
-      if (readBit()) {
-        byte |= (1 << i);
+  // Runs in the alarm IRQ every kPollIntervalMs while converting. The main
+  // code stays off the bus until the state changes, so this may use the
+  // FIFOs directly: one read byte goes out, and the next call picks up the
+  // answer. The sensor holds read slots low until it is done.
+  int64_t pollConversion() {
+    if (pollPending_) {
+      pollPending_ = false;
+      if (pio_sm_get(pio_, sm_) >> 24 != 0) {
+        TRACE(ConversionFinished, 0);
+        state_ = State::Ready;
+        return 0;
       }
+      if (time_reached(deadline_)) {
+        state_ = State::TimedOut;
+        return 0;
+      }
+      return 1000 * kPollIntervalMs - kPollAnswerUs;
     }
-    printf("Read byte: %02X\n", byte);
-    return byte;
+    pio_sm_put(pio_, sm_, 0xFF);
+    pollPending_ = true;
+    return kPollAnswerUs;
   }
 
-  template <size_t N> void readBytes(std::array<uint8_t, N> &bytes) {
-    for (auto &byte : bytes) {
-      byte = readByte();
-    }
+  void setupDma() {
+    txDma_ = dma_claim_unused_channel(true);
+    dma_channel_config tx = dma_channel_get_default_config(txDma_);
+    channel_config_set_transfer_data_size(&tx, DMA_SIZE_8);
+    channel_config_set_read_increment(&tx, true);
+    channel_config_set_write_increment(&tx, false);
+    channel_config_set_dreq(&tx, pio_get_dreq(pio_, sm_, true));
+    dma_channel_configure(txDma_, &tx, &pio_->txf[sm_], nullptr, 0, false);
+
+    rxDma_ = dma_claim_unused_channel(true);
+    dma_channel_config rx = dma_channel_get_default_config(rxDma_);
+    channel_config_set_transfer_data_size(&rx, DMA_SIZE_8);
+    channel_config_set_read_increment(&rx, false);
+    channel_config_set_write_increment(&rx, true);
+    channel_config_set_dreq(&rx, pio_get_dreq(pio_, sm_, false));
+    // Autopush shifts right, so each byte read sits in the top byte lane.
+    const volatile void *rxByte =
+        reinterpret_cast<const volatile uint8_t *>(&pio_->rxf[sm_]) + 3;
+    dma_channel_configure(rxDma_, &rx, nullptr, rxByte, 0, false);
+  }
+
+  bool reset() {
+    pio_sm_exec_wait_blocking(pio_, sm_,
+                              pio_encode_jmp(offset_ + onewire_offset_reset));
+    const bool isPresent = (pio_sm_get_blocking(pio_, sm_) >> 31) == 0;
+    TRACE(OneWireReset, isPresent);
+    return isPresent;
   }
 
-  uint64_t readRom() {
-    writeByte(0x33);
-    uint64_t rom;
-    for (int i = 0; i < 4; ++i) {
-      rom |= (readByte() << (i * 8));
+  // Sends |size| bytes LSB first and replaces each one with the byte read
+  // back during its slots, so 0xFF reads a byte.
+  void transfer(uint8_t *bytes, size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+      TRACE(OneWireWrite, bytes[i]);
     }
-    return rom;
-    // My rom was 4294967295
+    // Every byte written pushes one back; RX goes first so it is ready.
+    dma_channel_set_write_addr(rxDma_, bytes, false);
+    dma_channel_set_trans_count(rxDma_, size, true);
+    dma_channel_set_read_addr(txDma_, bytes, false);
+    dma_channel_set_trans_count(txDma_, size, true);
+    sleep_us(size * kByteUs);
+    dma_channel_wait_for_finish_blocking(rxDma_);
+    for (size_t i = 0; i < size; ++i) {
+      TRACE(OneWireRead, bytes[i]);
+    }
+  }
+
+  template <size_t N> void transfer(std::array<uint8_t, N> &bytes) {
+    transfer(bytes.data(), N);
+  }
+
+  void writeByte(uint8_t byte) {
+    std::array<uint8_t, 1> bytes = {byte};
+    transfer(bytes);
   }
 
-  void skipRom() { writeByte(0xCC); }
 
   float decodeTemperature(uint8_t lsb, uint8_t msb) {
     int16_t rawTemperature =
@@ -298,6 +752,25 @@ private:
 
 private:
   int pin_;
+  PIO pio_;
+  uint sm_;
+  uint offset_;
+  uint txDma_;
+  uint rxDma_;
+
+  volatile State state_ = State::Idle;
+  alarm_id_t alarm_ = 0;
+  absolute_time_t deadline_;
+  bool pollPending_ = false;
+
+  std::array<uint64_t, kMaxSensors> roms_ = {};
+  size_t numSensors_ = 0;
+
+  bool checkCrc_ = true;
+  int maxRetries_ = 2;
+  uint32_t retryBackoffUs_ = 1000;
+  uint32_t crcFailures_ = 0;
+  uint32_t retries_ = 0;
 };
 
 int main() {
@@ -305,10 +778,34 @@ int main() {
 
   printf("Begin\n");
   sleep_ms(5000);
-  DS18B20 sensor(26);
+  DS18B20 sensors(26);
+  absolute_time_t nextReading = get_absolute_time();
   while (1) {
-    printf("Temperature: %f\n", *sensor.getTemperature());
-    sleep_ms(1000);
+    if (time_reached(nextReading) && sensors.conversionDone()) {
+      for (size_t i = 0; i < sensors.numSensors(); ++i) {
+        float celsius;
+        const auto status = sensors.readResult(i, celsius);
+        if (status == DS18B20::Status::Ok) {
+          printf("Temperature %016llX: %f\n",
+                 static_cast<unsigned long long>(sensors.rom(i)), celsius);
+        } else if (status != DS18B20::Status::NotStarted) {
+          LOG_ERROR("Sensor %zu: %s\n", i, DS18B20::describe(status));
+        }
+      }
+      if (sensors.numSensors() == 0 && sensors.searchSensors() > 0) {
+        LOG_INFO("Found %zu sensors\n", sensors.numSensors());
+      }
+      const auto started = sensors.startConversion();
+      if (started != DS18B20::Status::Ok) {
+        LOG_ERROR("Sensor: %s\n", DS18B20::describe(started));
+      }
+      LOG_DEBUG("CRC failures %lu, retries %lu\n",
+                static_cast<unsigned long>(sensors.crcFailures()),
+                static_cast<unsigned long>(sensors.retries()));
+      nextReading = make_timeout_time_ms(1000);
+    }
+    drainTrace();
+    sleep_ms(10);
   }
   return 0;
 }
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "hardware/regs/dreq.h"
+#include "pico.h"
+
+// Only FIFO is modelled: each read, by DMA or adc_fifo_get_blocking(), takes
+// the conversion that finished last while the ADC free-runs.
+typedef struct {
+  volatile uint32_t cs;
+  volatile uint32_t result;
+  volatile uint32_t fcs;
+  volatile uint32_t fifo;
+  volatile uint32_t div;
+} adc_hw_t;
+
+extern adc_hw_t *const adc_hw;
+
+void adc_init();
+void adc_gpio_init(uint gpio);
+void adc_select_input(uint input);
+uint adc_get_selected_input();
+void adc_set_temp_sensor_enabled(bool enable);
+uint16_t adc_read();
+
+// Free-running mode: one conversion every max(96, 1 + |clkdiv|) cycles of
+// the 48 MHz ADC clock, cycling through the inputs set in |input_mask|
+// upwards from the selected one.
+void adc_set_round_robin(uint input_mask);
+void adc_set_clkdiv(float clkdiv);
+void adc_fifo_setup(bool en, bool dreq_en, uint16_t dreq_thresh,
+                    bool err_in_fifo, bool byte_shift);
+void adc_run(bool run);
+void adc_fifo_drain();
+uint16_t adc_fifo_get_blocking();
@@ -0,0 +1,103 @@
+#pragma once
+
+#include "hardware/regs/dreq.h"
+#include "pico.h"
+
+#define NUM_DMA_CHANNELS 12
+
+enum dma_channel_transfer_size {
+  DMA_SIZE_8 = 0,
+  DMA_SIZE_16 = 1,
+  DMA_SIZE_32 = 2,
+};
+
+typedef struct {
+  dma_channel_transfer_size data_size;
+  bool read_increment;
+  bool write_increment;
+  uint dreq;
+  uint chain_to;
+  bool ring_write;
+  uint ring_size_bits;
+  bool irq_quiet;
+  bool enable;
+} dma_channel_config;
+
+typedef struct {
+  volatile uintptr_t read_addr;
+  volatile uintptr_t write_addr;
+  volatile uint32_t transfer_count;
+} dma_channel_hw_t;
+
+int dma_claim_unused_channel(bool required);
+void dma_channel_claim(uint channel);
+void dma_channel_unclaim(uint channel);
+bool dma_channel_is_claimed(uint channel);
+
+dma_channel_config dma_channel_get_default_config(uint channel);
+
+inline void
+channel_config_set_transfer_data_size(dma_channel_config *c,
+                                      dma_channel_transfer_size size) {
+  c->data_size = size;
+}
+inline void channel_config_set_read_increment(dma_channel_config *c,
+                                              bool incr) {
+  c->read_increment = incr;
+}
+inline void channel_config_set_write_increment(dma_channel_config *c,
+                                               bool incr) {
+  c->write_increment = incr;
+}
+inline void channel_config_set_dreq(dma_channel_config *c, uint dreq) {
+  c->dreq = dreq;
+}
+inline void channel_config_set_chain_to(dma_channel_config *c,
+                                        uint chain_to) {
+  c->chain_to = chain_to;
+}
+inline void channel_config_set_ring(dma_channel_config *c, bool write,
+                                    uint size_bits) {
+  c->ring_write = write;
+  c->ring_size_bits = size_bits;
+}
+inline void channel_config_set_irq_quiet(dma_channel_config *c,
+                                         bool irq_quiet) {
+  c->irq_quiet = irq_quiet;
+}
+inline void channel_config_set_enable(dma_channel_config *c, bool enable) {
+  c->enable = enable;
+}
+
+dma_channel_hw_t *dma_channel_hw_addr(uint channel);
+
+void dma_channel_set_config(uint channel, const dma_channel_config *config,
+                            bool trigger);
+void dma_channel_set_read_addr(uint channel, const volatile void *read_addr,
+                               bool trigger);
+void dma_channel_set_write_addr(uint channel, volatile void *write_addr,
+                                bool trigger);
+void dma_channel_set_trans_count(uint channel, uint32_t trans_count,
+                                 bool trigger);
+void dma_channel_configure(uint channel, const dma_channel_config *config,
+                           volatile void *write_addr,
+                           const volatile void *read_addr,
+                           uint transfer_count, bool trigger);
+void dma_channel_transfer_from_buffer_now(uint channel,
+                                          const volatile void *read_addr,
+                                          uint32_t transfer_count);
+void dma_channel_transfer_to_buffer_now(uint channel, volatile void *write_addr,
+                                        uint32_t transfer_count);
+void dma_channel_start(uint channel);
+void dma_start_channel_mask(uint32_t chan_mask);
+void dma_channel_abort(uint channel);
+
+bool dma_channel_is_busy(uint channel);
+void dma_channel_wait_for_finish_blocking(uint channel);
+
+void dma_channel_set_irq0_enabled(uint channel, bool enabled);
+void dma_channel_set_irq1_enabled(uint channel, bool enabled);
+bool dma_channel_get_irq0_status(uint channel);
+bool dma_channel_get_irq1_status(uint channel);
+void dma_channel_acknowledge_irq0(uint channel);
+void dma_channel_acknowledge_irq1(uint channel);
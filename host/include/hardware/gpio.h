@@ -0,0 +1,73 @@
+#pragma once
+
+#include "hardware/irq.h"
+#include "pico.h"
+
+#define GPIO_OUT 1
+#define GPIO_IN 0
+
+#define NUM_BANK0_GPIOS 30
+
+enum gpio_function {
+  GPIO_FUNC_XIP = 0,
+  GPIO_FUNC_SPI = 1,
+  GPIO_FUNC_UART = 2,
+  GPIO_FUNC_I2C = 3,
+  GPIO_FUNC_PWM = 4,
+  GPIO_FUNC_SIO = 5,
+  GPIO_FUNC_PIO0 = 6,
+  GPIO_FUNC_PIO1 = 7,
+  GPIO_FUNC_GPCK = 8,
+  GPIO_FUNC_USB = 9,
+  GPIO_FUNC_NULL = 0x1f,
+};
+
+void gpio_init(uint gpio);
+void gpio_set_function(uint gpio, gpio_function fn);
+gpio_function gpio_get_function(uint gpio);
+
+void gpio_set_dir(uint gpio, bool out);
+bool gpio_is_dir_out(uint gpio);
+
+void gpio_put(uint gpio, bool value);
+bool gpio_get(uint gpio);
+bool gpio_get_out_level(uint gpio);
+
+void gpio_set_pulls(uint gpio, bool up, bool down);
+inline void gpio_pull_up(uint gpio) { gpio_set_pulls(gpio, true, false); }
+inline void gpio_pull_down(uint gpio) { gpio_set_pulls(gpio, false, true); }
+inline void gpio_disable_pulls(uint gpio) {
+  gpio_set_pulls(gpio, false, false);
+}
+
+// Edge interrupts on IO_IRQ_BANK0. An input only has edges when it is driven
+// with pico_host::setGpioLevel(); level events are never raised.
+enum gpio_irq_level {
+  GPIO_IRQ_LEVEL_LOW = 0x1u,
+  GPIO_IRQ_LEVEL_HIGH = 0x2u,
+  GPIO_IRQ_EDGE_FALL = 0x4u,
+  GPIO_IRQ_EDGE_RISE = 0x8u,
+};
+
+typedef void (*gpio_irq_callback_t)(uint gpio, uint32_t event_mask);
+
+void gpio_set_irq_enabled(uint gpio, uint32_t event_mask, bool enabled);
+// One callback per core, for every pin not claimed by a raw handler.
+void gpio_set_irq_callback(gpio_irq_callback_t callback);
+void gpio_set_irq_enabled_with_callback(uint gpio, uint32_t event_mask,
+                                        bool enabled,
+                                        gpio_irq_callback_t callback);
+// Raw handlers see the IRQ for the pins in |gpio_mask| and must acknowledge
+// their events themselves.
+void gpio_add_raw_irq_handler_masked(uint32_t gpio_mask,
+                                     irq_handler_t handler);
+inline void gpio_add_raw_irq_handler(uint gpio, irq_handler_t handler) {
+  gpio_add_raw_irq_handler_masked(1u << gpio, handler);
+}
+void gpio_remove_raw_irq_handler_masked(uint32_t gpio_mask,
+                                        irq_handler_t handler);
+inline void gpio_remove_raw_irq_handler(uint gpio, irq_handler_t handler) {
+  gpio_remove_raw_irq_handler_masked(1u << gpio, handler);
+}
+uint32_t gpio_get_irq_event_mask(uint gpio);
+void gpio_acknowledge_irq(uint gpio, uint32_t event_mask);
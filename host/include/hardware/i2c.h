@@ -0,0 +1,47 @@
+#pragma once
+
+#include "hardware/regs/dreq.h"
+#include "pico.h"
+
+#define I2C_IC_DATA_CMD_RESTART_BITS 0x00000400
+#define I2C_IC_DATA_CMD_STOP_BITS 0x00000200
+#define I2C_IC_DATA_CMD_CMD_BITS 0x00000100
+#define I2C_IC_DATA_CMD_DAT_BITS 0x000000ff
+
+#define I2C_IC_STATUS_ACTIVITY_BITS 0x00000001
+#define I2C_IC_STATUS_TFNF_BITS 0x00000002
+#define I2C_IC_STATUS_TFE_BITS 0x00000004
+
+// STATUS says whether bytes queued by DMA are still on their way out.
+typedef struct {
+  volatile uint32_t enable;
+  volatile uint32_t tar;
+  volatile uint32_t data_cmd;
+  volatile uint32_t status;
+} i2c_hw_t;
+
+typedef struct i2c_inst {
+  i2c_hw_t *hw;
+  uint baudrate;
+} i2c_inst_t;
+
+extern i2c_inst_t i2c0_inst;
+extern i2c_inst_t i2c1_inst;
+
+#define i2c0 (&i2c0_inst)
+#define i2c1 (&i2c1_inst)
+
+uint i2c_init(i2c_inst_t *i2c, uint baudrate);
+void i2c_deinit(i2c_inst_t *i2c);
+uint i2c_get_index(i2c_inst_t *i2c);
+
+inline i2c_hw_t *i2c_get_hw(i2c_inst_t *i2c) { return i2c->hw; }
+
+inline uint i2c_get_dreq(i2c_inst_t *i2c, bool is_tx) {
+  return (i2c == i2c0 ? DREQ_I2C0_TX : DREQ_I2C1_TX) + (is_tx ? 0 : 1);
+}
+
+int i2c_write_blocking(i2c_inst_t *i2c, uint8_t addr, const uint8_t *src,
+                       size_t len, bool nostop);
+int i2c_read_blocking(i2c_inst_t *i2c, uint8_t addr, uint8_t *dst, size_t len,
+                      bool nostop);
@@ -0,0 +1,15 @@
+#pragma once
+
+#include "hardware/regs/intctrl.h"
+#include "pico.h"
+
+typedef void (*irq_handler_t)();
+
+#define PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY 0x80
+
+void irq_set_enabled(uint num, bool enabled);
+bool irq_is_enabled(uint num);
+void irq_set_exclusive_handler(uint num, irq_handler_t handler);
+void irq_add_shared_handler(uint num, irq_handler_t handler,
+                            uint8_t order_priority);
+void irq_remove_handler(uint num, irq_handler_t handler);
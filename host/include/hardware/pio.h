@@ -0,0 +1,178 @@
+#pragma once
+
+#include "hardware/gpio.h"
+#include "hardware/pio_instructions.h"
+#include "pico.h"
+
+#define NUM_PIOS 2
+#define NUM_PIO_STATE_MACHINES 4
+#define PIO_FIFO_DEPTH 4
+
+// Only the FIFO registers, so DMA can be pointed at them.
+typedef struct pio_hw_t {
+  volatile uint32_t txf[NUM_PIO_STATE_MACHINES];
+  volatile uint32_t rxf[NUM_PIO_STATE_MACHINES];
+} pio_hw_t;
+typedef pio_hw_t *PIO;
+
+extern pio_hw_t pio0_hw;
+extern pio_hw_t pio1_hw;
+
+#define pio0 (&pio0_hw)
+#define pio1 (&pio1_hw)
+
+typedef struct pio_program {
+  const uint16_t *instructions;
+  uint8_t length;
+  int8_t origin;
+  uint8_t pio_version;
+} pio_program_t;
+
+enum pio_fifo_join {
+  PIO_FIFO_JOIN_NONE = 0,
+  PIO_FIFO_JOIN_TX = 1,
+  PIO_FIFO_JOIN_RX = 2,
+};
+
+struct pio_sm_config;
+
+// Host only. The simulated state machines do not execute PIO instructions:
+// by default they just shift out every word they pull. A stand-in for a
+// program that reads the pins describes it with these hooks instead. Times
+// are in nanoseconds.
+typedef struct pio_host_program {
+  // The state machine starts shifting out |word| at |time_ns|. Returns true
+  // and sets |*rx| if that pushes a word to the RX FIFO.
+  bool (*shift)(const struct pio_sm_config *c, uint32_t word,
+                uint64_t time_ns, uint32_t *rx);
+  // pio_sm_exec() of |instruction| at |time_ns|. Returns how long the state
+  // machine runs before it pulls again, and may push a word like |shift|.
+  uint64_t (*exec)(const struct pio_sm_config *c, uint instruction,
+                   uint64_t time_ns, bool *pushed, uint32_t *rx);
+} pio_host_program;
+
+typedef struct pio_sm_config {
+  float clkdiv;
+  uint wrap_target;
+  uint wrap;
+  uint sideset_base;
+  uint out_base;
+  uint out_count;
+  uint set_base;
+  uint set_count;
+  uint in_base;
+  uint jmp_pin;
+  bool out_shift_right;
+  bool autopull;
+  uint pull_threshold;
+  bool in_shift_right;
+  bool autopush;
+  uint push_threshold;
+  pio_fifo_join join;
+  // Host only: how many state machine cycles one OUT takes, and how many
+  // bits it shifts (1 unless set). Used to model how fast the TX FIFO drains.
+  uint host_cycles_per_bit;
+  uint host_out_width;
+  // Host only: see pio_host_program. |host_offset| is where the program was
+  // loaded, for decoding jumps into it.
+  const pio_host_program *host_program;
+  uint host_offset;
+} pio_sm_config;
+
+pio_sm_config pio_get_default_sm_config();
+
+inline void sm_config_set_clkdiv(pio_sm_config *c, float div) {
+  c->clkdiv = div;
+}
+inline void sm_config_set_wrap(pio_sm_config *c, uint wrap_target, uint wrap) {
+  c->wrap_target = wrap_target;
+  c->wrap = wrap;
+}
+inline void sm_config_set_sideset_pins(pio_sm_config *c, uint sideset_base) {
+  c->sideset_base = sideset_base;
+}
+inline void sm_config_set_sideset(pio_sm_config *c, uint bit_count,
+                                  bool optional, bool pindirs) {}
+inline void sm_config_set_out_pins(pio_sm_config *c, uint out_base,
+                                   uint out_count) {
+  c->out_base = out_base;
+  c->out_count = out_count;
+}
+inline void sm_config_set_set_pins(pio_sm_config *c, uint set_base,
+                                   uint set_count) {
+  c->set_base = set_base;
+  c->set_count = set_count;
+}
+inline void sm_config_set_in_pins(pio_sm_config *c, uint in_base) {
+  c->in_base = in_base;
+}
+inline void sm_config_set_jmp_pin(pio_sm_config *c, uint pin) {
+  c->jmp_pin = pin;
+}
+inline void sm_config_set_out_shift(pio_sm_config *c, bool shift_right,
+                                    bool autopull, uint pull_threshold) {
+  c->out_shift_right = shift_right;
+  c->autopull = autopull;
+  c->pull_threshold = pull_threshold;
+}
+inline void sm_config_set_in_shift(pio_sm_config *c, bool shift_right,
+                                   bool autopush, uint push_threshold) {
+  c->in_shift_right = shift_right;
+  c->autopush = autopush;
+  c->push_threshold = push_threshold;
+}
+inline void sm_config_set_fifo_join(pio_sm_config *c, pio_fifo_join join) {
+  c->join = join;
+}
+inline void sm_config_set_host_cycles_per_bit(pio_sm_config *c, uint cycles) {
+  c->host_cycles_per_bit = cycles;
+}
+inline void sm_config_set_host_out_width(pio_sm_config *c, uint bits) {
+  c->host_out_width = bits;
+}
+inline void sm_config_set_host_program(pio_sm_config *c,
+                                       const pio_host_program *program,
+                                       uint offset) {
+  c->host_program = program;
+  c->host_offset = offset;
+}
+
+bool pio_can_add_program(PIO pio, const pio_program_t *program);
+uint pio_add_program(PIO pio, const pio_program_t *program);
+void pio_remove_program(PIO pio, const pio_program_t *program, uint offset);
+int pio_claim_unused_sm(PIO pio, bool required);
+void pio_sm_unclaim(PIO pio, uint sm);
+bool pio_claim_free_sm_and_add_program_for_gpio_range(
+    const pio_program_t *program, PIO *pio, uint *sm, uint *offset,
+    uint gpio_base, uint gpio_count, bool set_gpio_base);
+void pio_remove_program_and_unclaim_sm(const pio_program_t *program, PIO pio,
+                                       uint sm, uint offset);
+
+void pio_gpio_init(PIO pio, uint pin);
+int pio_sm_set_consecutive_pindirs(PIO pio, uint sm, uint pins_base,
+                                   uint pin_count, bool is_out);
+void pio_sm_set_pins_with_mask(PIO pio, uint sm, uint32_t pin_values,
+                               uint32_t pin_mask);
+void pio_sm_set_pindirs_with_mask(PIO pio, uint sm, uint32_t pin_dirs,
+                                  uint32_t pin_mask);
+int pio_sm_init(PIO pio, uint sm, uint initial_pc, const pio_sm_config *config);
+int pio_sm_set_config(PIO pio, uint sm, const pio_sm_config *config);
+void pio_sm_restart(PIO pio, uint sm);
+void pio_sm_set_enabled(PIO pio, uint sm, bool enabled);
+void pio_sm_clear_fifos(PIO pio, uint sm);
+void pio_sm_exec(PIO pio, uint sm, uint instr);
+void pio_sm_exec_wait_blocking(PIO pio, uint sm, uint instr);
+
+uint pio_get_index(PIO pio);
+uint pio_get_dreq(PIO pio, uint sm, bool is_tx);
+
+bool pio_sm_is_tx_fifo_full(PIO pio, uint sm);
+bool pio_sm_is_tx_fifo_empty(PIO pio, uint sm);
+uint pio_sm_get_tx_fifo_level(PIO pio, uint sm);
+void pio_sm_put(PIO pio, uint sm, uint32_t data);
+void pio_sm_put_blocking(PIO pio, uint sm, uint32_t data);
+
+bool pio_sm_is_rx_fifo_empty(PIO pio, uint sm);
+uint pio_sm_get_rx_fifo_level(PIO pio, uint sm);
+uint32_t pio_sm_get(PIO pio, uint sm);
+uint32_t pio_sm_get_blocking(PIO pio, uint sm);
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "pico.h"
+
+// Encoders for the instructions firmware usually hands to pio_sm_exec().
+
+enum pio_src_dest {
+  pio_pins = 0u,
+  pio_x = 1u,
+  pio_y = 2u,
+  pio_null = 3u,
+  pio_pindirs = 4u,
+  pio_exec_mov = 4u,
+  pio_status = 5u,
+  pio_pc = 5u,
+  pio_isr = 6u,
+  pio_osr = 7u,
+  pio_exec_out = 7u,
+};
+
+inline uint pio_encode_delay(uint cycles) { return cycles << 8u; }
+
+inline uint pio_encode_sideset(uint sideset_bit_count, uint value) {
+  return value << (13u - sideset_bit_count);
+}
+
+inline uint pio_encode_jmp(uint addr) { return addr & 0x1fu; }
+
+inline uint pio_encode_set(enum pio_src_dest dest, uint value) {
+  return 0xe000u | ((dest & 7u) << 5u) | (value & 0x1fu);
+}
+
+inline uint pio_encode_nop() { return 0xa042u; }
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "hardware/regs/dreq.h"
+#include "pico.h"
+
+#define NUM_PWM_SLICES 8
+
+enum pwm_chan { PWM_CHAN_A = 0, PWM_CHAN_B = 1 };
+
+// Only CC is modelled: a write sets channel A's level from the low half and
+// B's from the high half, which is what DMA-driven playback uses.
+typedef struct {
+  volatile uint32_t csr;
+  volatile uint32_t div;
+  volatile uint32_t ctr;
+  volatile uint32_t cc;
+  volatile uint32_t top;
+} pwm_slice_hw_t;
+
+typedef struct {
+  pwm_slice_hw_t slice[NUM_PWM_SLICES];
+} pwm_hw_t;
+
+extern pwm_hw_t *const pwm_hw;
+
+inline uint pwm_gpio_to_slice_num(uint gpio) { return (gpio >> 1u) & 7u; }
+inline uint pwm_gpio_to_channel(uint gpio) { return gpio & 1u; }
+
+// Raised once per counter wrap.
+inline uint pwm_get_dreq(uint slice_num) { return DREQ_PWM_WRAP0 + slice_num; }
+
+void pwm_set_clkdiv(uint slice_num, float divider);
+// |fract| is in sixteenths, as in the 8.4 DIV register.
+void pwm_set_clkdiv_int_frac(uint slice_num, uint8_t integer, uint8_t fract);
+void pwm_set_wrap(uint slice_num, uint16_t wrap);
+void pwm_set_chan_level(uint slice_num, uint chan, uint16_t level);
+void pwm_set_gpio_level(uint gpio, uint16_t level);
+void pwm_set_enabled(uint slice_num, bool enabled);
@@ -0,0 +1,17 @@
+#pragma once
+
+#include "pico.h"
+
+// The simulated core is only interrupted while it sleeps or blocks, so
+// masking interrupts has nothing to do on the host.
+inline uint32_t save_and_disable_interrupts() { return 0; }
+inline void restore_interrupts(uint32_t status) {}
+
+// Sleeps until the next event (an alarm, a DMA completion...) has run, as
+// the core would until the next interrupt. __sev() wakes core 1 from its
+// __wfe(); core 0 always wakes for the next event anyway.
+void __wfe();
+void __sev();
+
+#define __dmb()
+#define __compiler_memory_barrier()
@@ -0,0 +1,4 @@
+#pragma once
+
+#include "pico/platform.h"
+#include "pico/types.h"
@@ -0,0 +1,94 @@
+#pragma once
+
+// Control surface of the host-side simulated HAL. Only available when the
+// firmware is built from host/CMakeLists.txt, which defines PICO_HOST, so
+// firmware code must guard any use of it with #ifdef PICO_HOST.
+
+#include <functional>
+#include <vector>
+
+#include "pico.h"
+
+namespace pico_host {
+
+enum class Op : uint8_t {
+  GpioInit,
+  GpioSetFunction,
+  GpioSetDir,
+  GpioPut,
+  GpioSetPulls,
+  PwmSetClkdiv,
+  PwmSetWrap,
+  PwmSetLevel,
+  PwmSetEnabled,
+  AdcSelectInput,
+  AdcRead,
+  I2cInit,
+  I2cWrite,
+  PioSmInit,
+  PioSmSetEnabled,
+  PioPut,
+  PioExec,
+  PioPush,
+  OneWireReset,
+  PwmSetCc,
+};
+
+const char *opName(Op op);
+
+// One recorded pin or bus transaction. The meaning of a/b/c depends on the
+// op, e.g. (pin, level) for GpioPut or (address, length, nostop) for I2cWrite.
+// Bus transfers keep a copy of the bytes on the wire in the payload pool.
+struct Transaction {
+  uint64_t timeUs;
+  Op op;
+  uint32_t a;
+  uint32_t b;
+  uint32_t c;
+  uint32_t payloadOffset;
+  uint32_t payloadSize;
+};
+
+// Virtual time in microseconds since boot.
+uint64_t now();
+
+// Per-op counters are always maintained; the full transaction log only when
+// tracing is on (PICO_HOST_TRACE=<file.csv> or setTracing(true)).
+void setTracing(bool enabled);
+const std::vector<Transaction> &transactions();
+const uint8_t *payload(const Transaction &transaction);
+uint64_t count(Op op);
+void clearTransactions();
+
+// The firmware is stopped with exit(0) once virtual time passes the run
+// limit (PICO_HOST_RUN_MS, ten minutes by default). Zero means no limit.
+void setRunLimitUs(uint64_t limitUs);
+
+// Schedules |callback| at absolute virtual time |timeUs|. Callbacks run
+// synchronously while the firmware sleeps or blocks, like an IRQ would.
+uint64_t schedule(uint64_t timeUs, std::function<void()> callback);
+bool cancel(uint64_t id);
+
+// External world: what a GPIO input or an ADC channel reads at a given time.
+void setGpioInput(uint pin, std::function<bool(uint64_t timeUs)> source);
+// Drives a GPIO input from now on. Unlike setGpioInput() this makes edges,
+// so it raises the pin's edge interrupts. PICO_HOST_GPIO_PRESSES schedules
+// such levels from the environment.
+void setGpioLevel(uint pin, bool level);
+void setAdcInput(uint input, std::function<uint16_t(uint64_t timeUs)> source);
+
+// Simulated DS18B20 on the 1-wire bus on |pin|, answering with |rom| and
+// converting whatever |celsius| returns at the time. PICO_HOST_DS18B20 adds
+// devices from the environment instead.
+void addDs18b20(uint pin, uint64_t rom,
+                std::function<float(uint64_t timeUs)> celsius);
+
+// The 1-wire bus on |pin| as the master sees it. A reset pulse starting at
+// |timeUs| returns whether any device answered with a presence pulse; a slot
+// writes |bit| (a 1 doubles as a read slot) and returns the level sampled,
+// which a device pulls to 0 when it sends a 0. Meant for the PIO program
+// stand-ins in pio/.
+bool oneWireReset(uint pin, uint64_t timeUs);
+bool oneWireSlot(uint pin, bool bit, uint64_t timeUs);
+
+} // namespace pico_host
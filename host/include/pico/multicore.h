@@ -0,0 +1,17 @@
+#pragma once
+
+#include "pico.h"
+
+// Core 1 runs as a coroutine on the same virtual clock. It gets the CPU
+// whenever core 0 sleeps or blocks and it has something to do, and gives it
+// back whenever it sleeps or blocks itself, so neither core ever sees the
+// other halfway through a computation.
+void multicore_launch_core1(void (*entry)(void));
+
+// The two 8-entry inter-core FIFOs. Pushing wakes the other core from
+// __wfe(), as on hardware.
+bool multicore_fifo_rvalid();
+bool multicore_fifo_wready();
+void multicore_fifo_push_blocking(uint32_t data);
+uint32_t multicore_fifo_pop_blocking();
+void multicore_fifo_drain();
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdlib>
+
+#include "pico/types.h"
+
+#define __not_in_flash_func(func_name) func_name
+#define __time_critical_func(func_name) func_name
+
+#define hard_assert(x)                                                         \
+  do {                                                                         \
+    if (!(x)) {                                                                \
+      fprintf(stderr, "hard_assert failed: %s (%s:%d)\n", #x, __FILE__,        \
+              __LINE__);                                                       \
+      abort();                                                                 \
+    }                                                                          \
+  } while (0)
+
+// On hardware this is an empty hint for busy loops. On the host it lets the
+// virtual clock move forward so polling loops eventually observe the event
+// they are waiting for.
+void tight_loop_contents();
+
+// 1 while pico/multicore.h's core 1 is running.
+uint get_core_num();
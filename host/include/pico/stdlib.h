@@ -0,0 +1,9 @@
+#pragma once
+
+#include <cstdio>
+
+#include "hardware/gpio.h"
+#include "pico.h"
+#include "pico/time.h"
+
+bool stdio_init_all();
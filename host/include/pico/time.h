@@ -0,0 +1,67 @@
+#pragma once
+
+#include "pico.h"
+
+uint64_t time_us_64();
+uint32_t time_us_32();
+
+absolute_time_t get_absolute_time();
+
+inline uint64_t to_us_since_boot(absolute_time_t t) { return t; }
+inline absolute_time_t from_us_since_boot(uint64_t us) { return us; }
+inline uint32_t to_ms_since_boot(absolute_time_t t) {
+  return static_cast<uint32_t>(t / 1000);
+}
+inline absolute_time_t delayed_by_us(absolute_time_t t, uint64_t us) {
+  return t + us;
+}
+inline absolute_time_t delayed_by_ms(absolute_time_t t, uint32_t ms) {
+  return t + 1000ull * ms;
+}
+inline int64_t absolute_time_diff_us(absolute_time_t from,
+                                     absolute_time_t to) {
+  return static_cast<int64_t>(to - from);
+}
+absolute_time_t make_timeout_time_us(uint64_t us);
+absolute_time_t make_timeout_time_ms(uint32_t ms);
+inline bool time_reached(absolute_time_t t) { return time_us_64() >= t; }
+
+void sleep_until(absolute_time_t target);
+void sleep_us(uint64_t us);
+void sleep_ms(uint32_t ms);
+void busy_wait_us(uint64_t us);
+void busy_wait_us_32(uint32_t us);
+
+// Alarms from the default alarm pool. Callbacks run from the simulator's
+// event queue, like the timer IRQ they stand in for.
+typedef int32_t alarm_id_t;
+typedef int64_t (*alarm_callback_t)(alarm_id_t id, void *user_data);
+
+alarm_id_t add_alarm_at(absolute_time_t time, alarm_callback_t callback,
+                        void *user_data, bool fire_if_past);
+alarm_id_t add_alarm_in_us(uint64_t us, alarm_callback_t callback,
+                           void *user_data, bool fire_if_past);
+alarm_id_t add_alarm_in_ms(uint32_t ms, alarm_callback_t callback,
+                           void *user_data, bool fire_if_past);
+bool cancel_alarm(alarm_id_t alarm_id);
+
+// Repeating timers on the same pool. A positive delay counts from the end of
+// one callback to the next, a negative one from the start of one to the
+// next, so the timer keeps a fixed rate.
+typedef struct repeating_timer repeating_timer_t;
+typedef bool (*repeating_timer_callback_t)(repeating_timer_t *rt);
+
+struct repeating_timer {
+  int64_t delay_us;
+  alarm_id_t alarm_id;
+  repeating_timer_callback_t callback;
+  void *user_data;
+};
+
+bool add_repeating_timer_us(int64_t delay_us,
+                            repeating_timer_callback_t callback,
+                            void *user_data, repeating_timer_t *out);
+bool add_repeating_timer_ms(int32_t delay_ms,
+                            repeating_timer_callback_t callback,
+                            void *user_data, repeating_timer_t *out);
+bool cancel_repeating_timer(repeating_timer_t *timer);
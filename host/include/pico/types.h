@@ -0,0 +1,8 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+typedef unsigned int uint;
+
+typedef uint64_t absolute_time_t;
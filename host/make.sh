@@ -0,0 +1,6 @@
+#!/bin/sh
+
+mkdir build
+cd build
+cmake ..
+make -j 14
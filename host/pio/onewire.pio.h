@@ -0,0 +1,136 @@
+// Host stand-in for the header pioasm generates from day8/onewire.pio. The
+// instruction words are what pioasm emits for that program. The simulated
+// PIO does not execute them: the hooks below play the same slots against the
+// simulated 1-wire bus in pico/host.h instead.
+
+#pragma once
+
+#include "hardware/pio.h"
+#include "pico/host.h"
+
+#define onewire_wrap_target 8
+#define onewire_wrap 18
+#define onewire_pio_version 0
+
+#define onewire_offset_reset 0u
+#define onewire_offset_slot 8u
+
+static const uint16_t onewire_program_instructions[] = {
+    0xff3d, //  0: set    x, 29           side 1 [15]
+    0x1f41, //  1: jmp    x--, 1          side 1 [15]
+    0xe527, //  2: set    x, 7            side 0 [5]
+    0x0743, //  3: jmp    x--, 3          side 0 [7]
+    0x4001, //  4: in     pins, 1         side 0
+    0x8020, //  5: push   block           side 0
+    0xef39, //  6: set    x, 25           side 0 [15]
+    0x0f47, //  7: jmp    x--, 7          side 0 [15]
+    //     .wrap_target
+    0x6021, //  8: out    x, 1            side 0
+    0x112e, //  9: jmp    !x, 14          side 1 [1]
+    0xa942, // 10: nop                    side 0 [9]
+    0xaf40, // 11: mov    y, pins         side 0 [15]
+    0xaf42, // 12: nop                    side 0 [15]
+    0x0f12, // 13: jmp    18              side 0 [15]
+    0xff40, // 14: set    y, 0            side 1 [15]
+    0xbf42, // 15: nop                    side 1 [15]
+    0xbf42, // 16: nop                    side 1 [15]
+    0xb942, // 17: nop                    side 1 [9]
+    0x4441, // 18: in     y, 1            side 0 [4]
+    //     .wrap
+};
+
+static const struct pio_program onewire_program = {
+    .instructions = onewire_program_instructions,
+    .length = 19,
+    .origin = -1,
+    .pio_version = onewire_pio_version,
+};
+
+#include "hardware/clocks.h"
+
+// Cycle counts of the program above.
+#define onewire_host_slot_cycles 66
+#define onewire_host_reset_cycles 1000
+
+static inline uint64_t onewire_host_cycle_ns(const pio_sm_config *c) {
+  return (uint64_t)(1e9 * c->clkdiv / clock_get_hz(clk_sys));
+}
+
+static inline bool onewire_host_shift(const pio_sm_config *c, uint32_t word,
+                                      uint64_t time_ns, uint32_t *rx) {
+  const uint64_t slot_ns = onewire_host_slot_cycles * onewire_host_cycle_ns(c);
+  const uint bits = c->pull_threshold;
+  uint32_t value = 0;
+  for (uint i = 0; i < bits; ++i) {
+    const bool bit = (word >> i) & 1;
+    const uint64_t slot_us = (time_ns + i * slot_ns) / 1000;
+    if (pico_host::oneWireSlot(c->in_base, bit, slot_us)) {
+      value |= 1u << i;
+    }
+  }
+  *rx = value << (32 - bits);
+  return true;
+}
+
+static inline uint64_t onewire_host_exec(const pio_sm_config *c,
+                                         uint instruction, uint64_t time_ns,
+                                         bool *pushed, uint32_t *rx) {
+  if (instruction != pio_encode_jmp(c->host_offset + onewire_offset_reset)) {
+    return 0;
+  }
+  const bool present = pico_host::oneWireReset(c->in_base, time_ns / 1000);
+  *pushed = true;
+  *rx = present ? 0 : 1u << 31;
+  return onewire_host_reset_cycles * onewire_host_cycle_ns(c);
+}
+
+static const pio_host_program onewire_host_program = {
+    .shift = onewire_host_shift,
+    .exec = onewire_host_exec,
+};
+
+static inline pio_sm_config onewire_program_get_default_config(uint offset) {
+  pio_sm_config c = pio_get_default_sm_config();
+  sm_config_set_wrap(&c, offset + onewire_wrap_target, offset + onewire_wrap);
+  sm_config_set_sideset(&c, 1, false, true);
+  sm_config_set_host_cycles_per_bit(&c, onewire_host_slot_cycles);
+  sm_config_set_host_program(&c, &onewire_host_program, offset);
+  return c;
+}
+
+#include "hardware/gpio.h"
+
+// |bits| per FIFO word: 8 to move bytes (DMA can feed and drain those
+// directly), 1 for single slots like the ROM search needs.
+static inline pio_sm_config onewire_program_config(uint offset, uint pin,
+                                                   uint bits) {
+  pio_sm_config c = onewire_program_get_default_config(offset);
+  sm_config_set_sideset_pins(&c, pin);
+  sm_config_set_in_pins(&c, pin);
+  sm_config_set_out_shift(&c, true, true, bits);
+  sm_config_set_in_shift(&c, true, true, bits);
+  sm_config_set_clkdiv(&c, clock_get_hz(clk_sys) / 1e6f);
+  return c;
+}
+
+static inline void onewire_program_init(PIO pio, uint sm, uint offset,
+                                        uint pin) {
+  pio_sm_set_pins_with_mask(pio, sm, 0, 1u << pin);
+  pio_sm_set_pindirs_with_mask(pio, sm, 0, 1u << pin);
+  pio_gpio_init(pio, pin);
+  gpio_pull_up(pin);
+
+  pio_sm_config c = onewire_program_config(offset, pin, 8);
+  pio_sm_init(pio, sm, offset + onewire_offset_slot, &c);
+  pio_sm_set_enabled(pio, sm, true);
+}
+
+// Only while the state machine waits for its next word. The restart empties
+// the shift counters so the new threshold applies from the next pull. Send
+// resets in byte mode: with 1 bit per word the presence bit is pushed twice.
+static inline void onewire_set_bits_per_word(PIO pio, uint sm, uint offset,
+                                             uint pin, uint bits) {
+  pio_sm_config c = onewire_program_config(offset, pin, bits);
+  pio_sm_set_config(pio, sm, &c);
+  pio_sm_restart(pio, sm);
+}
@@ -0,0 +1,60 @@
+// Host stand-in for the header pioasm generates from day12/ws2812.pio. The
+// instruction words are what pioasm emits for that program; the simulated
+// PIO does not execute them, it only uses the timing to drain the TX FIFO.
+
+#pragma once
+
+#include "hardware/pio.h"
+
+#define ws2812_wrap_target 0
+#define ws2812_wrap 3
+#define ws2812_pio_version 0
+
+#define ws2812_T1 3
+#define ws2812_T2 3
+#define ws2812_T3 4
+
+static const uint16_t ws2812_program_instructions[] = {
+    //     .wrap_target
+    0x6321, //  0: out    x, 1            side 0 [3]
+    0x1223, //  1: jmp    !x, 3           side 1 [2]
+    0x1200, //  2: jmp    0               side 1 [2]
+    0xa242, //  3: nop                    side 0 [2]
+    //     .wrap
+};
+
+static const struct pio_program ws2812_program = {
+    .instructions = ws2812_program_instructions,
+    .length = 4,
+    .origin = -1,
+    .pio_version = ws2812_pio_version,
+};
+
+static inline pio_sm_config ws2812_program_get_default_config(uint offset) {
+  pio_sm_config c = pio_get_default_sm_config();
+  sm_config_set_wrap(&c, offset + ws2812_wrap_target, offset + ws2812_wrap);
+  sm_config_set_sideset(&c, 1, false, false);
+  sm_config_set_host_cycles_per_bit(&c, ws2812_T1 + ws2812_T2 + ws2812_T3);
+  return c;
+}
+
+#include "hardware/clocks.h"
+
+static inline void ws2812_program_init(PIO pio, uint sm, uint offset, uint pin,
+                                       float freq, bool rgbw) {
+
+  pio_gpio_init(pio, pin);
+  pio_sm_set_consecutive_pindirs(pio, sm, pin, 1, true);
+
+  pio_sm_config c = ws2812_program_get_default_config(offset);
+  sm_config_set_sideset_pins(&c, pin);
+  sm_config_set_out_shift(&c, false, true, rgbw ? 32 : 24);
+  sm_config_set_fifo_join(&c, PIO_FIFO_JOIN_TX);
+
+  int cycles_per_bit = ws2812_T1 + ws2812_T2 + ws2812_T3;
+  float div = clock_get_hz(clk_sys) / (freq * cycles_per_bit);
+  sm_config_set_clkdiv(&c, div);
+
+  pio_sm_init(pio, sm, offset, &c);
+  pio_sm_set_enabled(pio, sm, true);
+}
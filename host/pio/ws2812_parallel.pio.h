@@ -0,0 +1,68 @@
+// Host stand-in for the header pioasm generates from
+// day12/ws2812_parallel.pio. The instruction words are what pioasm emits for
+// that program; the simulated PIO does not execute them, it only uses the
+// timing to drain the TX FIFO.
+
+#pragma once
+
+#include "hardware/pio.h"
+
+#define ws2812_parallel_wrap_target 0
+#define ws2812_parallel_wrap 3
+#define ws2812_parallel_pio_version 0
+
+#define ws2812_parallel_T1 3
+#define ws2812_parallel_T2 3
+#define ws2812_parallel_T3 4
+
+static const uint16_t ws2812_parallel_program_instructions[] = {
+    //     .wrap_target
+    0x6028, //  0: out    x, 8
+    0xa20b, //  1: mov    pins, ~null     [2]
+    0xa201, //  2: mov    pins, x         [2]
+    0xa203, //  3: mov    pins, null      [2]
+    //     .wrap
+};
+
+static const struct pio_program ws2812_parallel_program = {
+    .instructions = ws2812_parallel_program_instructions,
+    .length = 4,
+    .origin = -1,
+    .pio_version = ws2812_parallel_pio_version,
+};
+
+static inline pio_sm_config
+ws2812_parallel_program_get_default_config(uint offset) {
+  pio_sm_config c = pio_get_default_sm_config();
+  sm_config_set_wrap(&c, offset + ws2812_parallel_wrap_target,
+                     offset + ws2812_parallel_wrap);
+  sm_config_set_host_cycles_per_bit(
+      &c, ws2812_parallel_T1 + ws2812_parallel_T2 + ws2812_parallel_T3);
+  sm_config_set_host_out_width(&c, 8);
+  return c;
+}
+
+#include "hardware/clocks.h"
+
+// Words are four bit planes, first one in the low byte.
+static inline void ws2812_parallel_program_init(PIO pio, uint sm, uint offset,
+                                                uint pin_base, uint pin_count,
+                                                float freq) {
+  for (uint i = pin_base; i < pin_base + pin_count; i++) {
+    pio_gpio_init(pio, i);
+  }
+  pio_sm_set_consecutive_pindirs(pio, sm, pin_base, pin_count, true);
+
+  pio_sm_config c = ws2812_parallel_program_get_default_config(offset);
+  sm_config_set_out_shift(&c, true, true, 32);
+  sm_config_set_out_pins(&c, pin_base, pin_count);
+  sm_config_set_fifo_join(&c, PIO_FIFO_JOIN_TX);
+
+  int cycles_per_bit =
+      ws2812_parallel_T1 + ws2812_parallel_T2 + ws2812_parallel_T3;
+  float div = clock_get_hz(clk_sys) / (freq * cycles_per_bit);
+  sm_config_set_clkdiv(&c, div);
+
+  pio_sm_init(pio, sm, offset, &c);
+  pio_sm_set_enabled(pio, sm, true);
+}
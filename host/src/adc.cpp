@@ -0,0 +1,141 @@
+#include "hardware/adc.h"
+
+#include <algorithm>
+#include <array>
+#include <vector>
+
+#include "hardware/clocks.h"
+#include "hardware/gpio.h"
+#include "sim.h"
+
+namespace {
+
+constexpr uint kNumInputs = 5;
+constexpr uint kTemperatureInput = 4;
+// 96 cycles of the 48 MHz ADC clock.
+constexpr uint kConversionCycles = 96;
+constexpr uint64_t kConversionUs = 2;
+
+uint selectedInput = 0;
+std::array<std::function<uint16_t(uint64_t)>, kNumInputs> sources;
+adc_hw_t registers;
+
+uint roundRobinMask = 0;
+float clockDivider = 0;
+bool running = false;
+uint64_t runStartNs = 0;
+// Inputs in the order free-running mode converts them.
+std::vector<uint> sequence;
+
+uint16_t idleValue(uint input) {
+  // 0.706 V from the temperature sensor is 27 C; everything else floats
+  // around mid-scale.
+  return input == kTemperatureInput ? 876 : 2048;
+}
+
+uint16_t convert(uint input, uint64_t timeUs) {
+  const auto &source = sources[input];
+  return source ? source(timeUs) & 0xfff : idleValue(input);
+}
+
+uint64_t conversionNs() {
+  const double cycles = std::max<double>(kConversionCycles, 1 + clockDivider);
+  return static_cast<uint64_t>(1e9 * cycles / clock_get_hz(clk_adc));
+}
+
+// Index of the last conversion done by |timeNs|.
+uint64_t conversionIndex(uint64_t timeNs) {
+  return (timeNs - runStartNs) / conversionNs() - 1;
+}
+
+uint64_t paceConversion(uint64_t earliestNs) {
+  if (!running) {
+    return pico_host::kDreqIdle;
+  }
+  const uint64_t period = conversionNs();
+  const uint64_t sinceNs =
+      earliestNs > runStartNs ? earliestNs - runStartNs : 0;
+  // One conversion at a time: the next one strictly after |earliestNs|.
+  return runStartNs + (sinceNs / period + 1) * period;
+}
+
+uint32_t readFifo(uint64_t timeNs) {
+  const uint input = sequence[conversionIndex(timeNs) % sequence.size()];
+  const uint16_t value = convert(input, timeNs / 1000);
+  pico_host::recordAt(timeNs / 1000, pico_host::Op::AdcRead, input, value);
+  return value;
+}
+
+} // namespace
+
+adc_hw_t *const adc_hw = &registers;
+
+void adc_init() {}
+
+void adc_gpio_init(uint gpio) {
+  gpio_set_function(gpio, GPIO_FUNC_NULL);
+  gpio_disable_pulls(gpio);
+}
+
+void adc_select_input(uint input) {
+  selectedInput = input;
+  pico_host::record(pico_host::Op::AdcSelectInput, input);
+}
+
+uint adc_get_selected_input() { return selectedInput; }
+
+void adc_set_temp_sensor_enabled(bool enable) {}
+
+uint16_t adc_read() {
+  pico_host::advanceBy(kConversionUs);
+  const uint16_t value = convert(selectedInput, pico_host::now());
+  pico_host::record(pico_host::Op::AdcRead, selectedInput, value);
+  return value;
+}
+
+void adc_set_round_robin(uint input_mask) { roundRobinMask = input_mask; }
+
+void adc_set_clkdiv(float clkdiv) { clockDivider = clkdiv; }
+
+void adc_fifo_setup(bool en, bool dreq_en, uint16_t dreq_thresh,
+                    bool err_in_fifo, bool byte_shift) {
+  pico_host::registerDreq(DREQ_ADC, paceConversion);
+  pico_host::registerReadPort(&registers.fifo, readFifo);
+}
+
+void adc_run(bool run) {
+  if (run && !running) {
+    // Starting from the selected input, which should be one of the mask's.
+    sequence.clear();
+    for (uint i = 0; i < kNumInputs; ++i) {
+      const uint input = (selectedInput + i) % kNumInputs;
+      if (roundRobinMask & (1u << input)) {
+        sequence.push_back(input);
+      }
+    }
+    if (sequence.empty()) {
+      sequence.push_back(selectedInput);
+    }
+    runStartNs = pico_host::now() * 1000;
+  }
+  running = run;
+  if (running) {
+    pico_host::signalDreq(DREQ_ADC);
+  }
+}
+
+void adc_fifo_drain() {}
+
+uint16_t adc_fifo_get_blocking() {
+  const uint64_t readyNs = paceConversion(pico_host::now() * 1000);
+  pico_host::advanceTo((readyNs + 999) / 1000);
+  return readFifo(readyNs);
+}
+
+namespace pico_host {
+
+void setAdcInput(uint input, std::function<uint16_t(uint64_t timeUs)> source) {
+  sources[input] = std::move(source);
+}
+
+} // namespace pico_host
@@ -0,0 +1,341 @@
+#include "hardware/dma.h"
+
+#include <array>
+#include <cstring>
+#include <deque>
+#include <unordered_map>
+
+#include "hardware/irq.h"
+#include "sim.h"
+
+namespace {
+
+// Elements are moved in batches so that long paced transfers do not cost one
+// simulator event each. A batch never spans more than this much time, which
+// bounds how late the rest of the firmware sees the data land.
+constexpr size_t kMaxBatch = 16;
+constexpr uint64_t kMaxBatchSpanNs = 50'000;
+
+struct Channel {
+  bool claimed = false;
+  dma_channel_config config = {};
+  dma_channel_hw_t hw = {};
+  uint32_t reloadCount = 0;
+  bool busy = false;
+  uint64_t lastNs = 0;
+  std::deque<uint64_t> scheduledNs;
+  uint64_t eventId = 0;
+  // Paced by a DREQ that was idle last time we asked.
+  bool waiting = false;
+  bool irq0Enabled = false;
+  bool irq1Enabled = false;
+  bool irq0Status = false;
+  bool irq1Status = false;
+};
+
+std::array<Channel, NUM_DMA_CHANNELS> channels;
+
+auto &dreqs() {
+  static std::unordered_map<uint, std::function<uint64_t(uint64_t)>> dreqs;
+  return dreqs;
+}
+
+auto &writePorts() {
+  static std::unordered_map<uintptr_t,
+                            std::function<void(uint32_t, uint64_t)>>
+      ports;
+  return ports;
+}
+
+auto &readPorts() {
+  static std::unordered_map<uintptr_t, std::function<uint32_t(uint64_t)>>
+      ports;
+  return ports;
+}
+
+uintptr_t advance(uintptr_t address, uint size, bool ring, uint ringBits) {
+  if (!ring || ringBits == 0) {
+    return address + size;
+  }
+  const uintptr_t mask = (uintptr_t(1) << ringBits) - 1;
+  return (address & ~mask) | ((address + size) & mask);
+}
+
+void moveElement(Channel &channel, uint64_t timeNs) {
+  const auto &config = channel.config;
+  const uint size = 1u << config.data_size;
+  uint32_t value = 0;
+  const auto reader = readPorts().find(uintptr_t(channel.hw.read_addr));
+  if (reader != readPorts().end()) {
+    value = reader->second(timeNs);
+  } else {
+    std::memcpy(&value, reinterpret_cast<const void *>(channel.hw.read_addr),
+                size);
+  }
+  const auto writer = writePorts().find(uintptr_t(channel.hw.write_addr));
+  if (writer != writePorts().end()) {
+    writer->second(value, timeNs);
+  } else {
+    std::memcpy(reinterpret_cast<void *>(channel.hw.write_addr), &value, size);
+  }
+  if (config.read_increment) {
+    channel.hw.read_addr = advance(channel.hw.read_addr, size,
+                                   !config.ring_write, config.ring_size_bits);
+  }
+  if (config.write_increment) {
+    channel.hw.write_addr = advance(channel.hw.write_addr, size,
+                                    config.ring_write, config.ring_size_bits);
+  }
+  --channel.hw.transfer_count;
+}
+
+void start(uint index);
+
+void complete(uint index) {
+  auto &channel = channels[index];
+  channel.busy = false;
+  if (channel.config.chain_to != index) {
+    start(channel.config.chain_to);
+  }
+  if (channel.config.irq_quiet) {
+    return;
+  }
+  if (channel.irq0Enabled) {
+    channel.irq0Status = true;
+    pico_host::raiseIrq(DMA_IRQ_0);
+  }
+  if (channel.irq1Enabled) {
+    channel.irq1Status = true;
+    pico_host::raiseIrq(DMA_IRQ_1);
+  }
+}
+
+// Moves every element whose time has come, then plans the next batch.
+void run(uint index) {
+  auto &channel = channels[index];
+  channel.eventId = 0;
+  const uint64_t nowNs = pico_host::now() * 1000;
+  while (true) {
+    while (!channel.scheduledNs.empty() &&
+           channel.scheduledNs.front() <= nowNs) {
+      channel.lastNs = channel.scheduledNs.front();
+      channel.scheduledNs.pop_front();
+      moveElement(channel, channel.lastNs);
+    }
+    if (channel.hw.transfer_count == 0) {
+      complete(index);
+      return;
+    }
+    if (channel.scheduledNs.empty()) {
+      const auto pace = dreqs().find(channel.config.dreq);
+      uint64_t timeNs = channel.lastNs;
+      for (size_t i = 0; i < kMaxBatch && i < channel.hw.transfer_count; ++i) {
+        if (channel.config.dreq != DREQ_FORCE && pace != dreqs().end()) {
+          const uint64_t pacedNs = pace->second(timeNs);
+          if (pacedNs == pico_host::kDreqIdle) {
+            break;
+          }
+          timeNs = pacedNs;
+        }
+        channel.scheduledNs.push_back(timeNs);
+        if (timeNs - channel.scheduledNs.front() > kMaxBatchSpanNs) {
+          break;
+        }
+      }
+      if (channel.scheduledNs.empty()) {
+        channel.waiting = true;
+        return;
+      }
+    }
+    if (channel.scheduledNs.back() > nowNs) {
+      break;
+    }
+  }
+  channel.eventId = pico_host::schedule(
+      (channel.scheduledNs.back() + 999) / 1000, [index] { run(index); });
+}
+
+void start(uint index) {
+  auto &channel = channels[index];
+  if (channel.busy || !channel.config.enable) {
+    return;
+  }
+  channel.busy = true;
+  channel.waiting = false;
+  channel.hw.transfer_count = channel.reloadCount;
+  channel.lastNs = pico_host::now() * 1000;
+  channel.scheduledNs.clear();
+  run(index);
+}
+
+} // namespace
+
+int dma_claim_unused_channel(bool required) {
+  for (uint i = 0; i < NUM_DMA_CHANNELS; ++i) {
+    if (!channels[i].claimed) {
+      channels[i].claimed = true;
+      return i;
+    }
+  }
+  hard_assert(!required);
+  return -1;
+}
+
+void dma_channel_claim(uint channel) { channels[channel].claimed = true; }
+
+void dma_channel_unclaim(uint channel) { channels[channel].claimed = false; }
+
+bool dma_channel_is_claimed(uint channel) { return channels[channel].claimed; }
+
+dma_channel_config dma_channel_get_default_config(uint channel) {
+  dma_channel_config c = {};
+  c.data_size = DMA_SIZE_32;
+  c.read_increment = true;
+  c.write_increment = false;
+  c.dreq = DREQ_FORCE;
+  c.chain_to = channel;
+  c.enable = true;
+  return c;
+}
+
+dma_channel_hw_t *dma_channel_hw_addr(uint channel) {
+  return &channels[channel].hw;
+}
+
+void dma_channel_set_config(uint channel, const dma_channel_config *config,
+                            bool trigger) {
+  channels[channel].config = *config;
+  if (trigger) {
+    start(channel);
+  }
+}
+
+void dma_channel_set_read_addr(uint channel, const volatile void *read_addr,
+                               bool trigger) {
+  channels[channel].hw.read_addr = reinterpret_cast<uintptr_t>(read_addr);
+  if (trigger) {
+    start(channel);
+  }
+}
+
+void dma_channel_set_write_addr(uint channel, volatile void *write_addr,
+                                bool trigger) {
+  channels[channel].hw.write_addr = reinterpret_cast<uintptr_t>(write_addr);
+  if (trigger) {
+    start(channel);
+  }
+}
+
+void dma_channel_set_trans_count(uint channel, uint32_t trans_count,
+                                 bool trigger) {
+  channels[channel].reloadCount = trans_count;
+  if (trigger) {
+    start(channel);
+  }
+}
+
+void dma_channel_configure(uint channel, const dma_channel_config *config,
+                           volatile void *write_addr,
+                           const volatile void *read_addr,
+                           uint transfer_count, bool trigger) {
+  dma_channel_set_read_addr(channel, read_addr, false);
+  dma_channel_set_write_addr(channel, write_addr, false);
+  dma_channel_set_trans_count(channel, transfer_count, false);
+  dma_channel_set_config(channel, config, trigger);
+}
+
+void dma_channel_transfer_from_buffer_now(uint channel,
+                                          const volatile void *read_addr,
+                                          uint32_t transfer_count) {
+  dma_channel_set_read_addr(channel, read_addr, false);
+  dma_channel_set_trans_count(channel, transfer_count, true);
+}
+
+void dma_channel_transfer_to_buffer_now(uint channel, volatile void *write_addr,
+                                        uint32_t transfer_count) {
+  dma_channel_set_write_addr(channel, write_addr, false);
+  dma_channel_set_trans_count(channel, transfer_count, true);
+}
+
+void dma_channel_start(uint channel) { start(channel); }
+
+void dma_start_channel_mask(uint32_t chan_mask) {
+  for (uint i = 0; i < NUM_DMA_CHANNELS; ++i) {
+    if (chan_mask & (1u << i)) {
+      start(i);
+    }
+  }
+}
+
+void dma_channel_abort(uint channel) {
+  auto &state = channels[channel];
+  if (state.eventId != 0) {
+    pico_host::cancel(state.eventId);
+    state.eventId = 0;
+  }
+  state.scheduledNs.clear();
+  state.busy = false;
+  state.waiting = false;
+}
+
+bool dma_channel_is_busy(uint channel) { return channels[channel].busy; }
+
+void dma_channel_wait_for_finish_blocking(uint channel) {
+  while (dma_channel_is_busy(channel)) {
+    tight_loop_contents();
+  }
+}
+
+void dma_channel_set_irq0_enabled(uint channel, bool enabled) {
+  channels[channel].irq0Enabled = enabled;
+}
+
+void dma_channel_set_irq1_enabled(uint channel, bool enabled) {
+  channels[channel].irq1Enabled = enabled;
+}
+
+bool dma_channel_get_irq0_status(uint channel) {
+  return channels[channel].irq0Status;
+}
+
+bool dma_channel_get_irq1_status(uint channel) {
+  return channels[channel].irq1Status;
+}
+
+void dma_channel_acknowledge_irq0(uint channel) {
+  channels[channel].irq0Status = false;
+}
+
+void dma_channel_acknowledge_irq1(uint channel) {
+  channels[channel].irq1Status = false;
+}
+
+namespace pico_host {
+
+void registerDreq(uint dreq, std::function<uint64_t(uint64_t)> pace) {
+  dreqs()[dreq] = std::move(pace);
+}
+
+void signalDreq(uint dreq) {
+  for (uint i = 0; i < NUM_DMA_CHANNELS; ++i) {
+    auto &channel = channels[i];
+    if (channel.busy && channel.waiting && channel.config.dreq == dreq) {
+      // Not run from here: the caller is usually in the middle of another
+      // channel's transfer.
+      channel.waiting = false;
+      channel.eventId = schedule(now(), [i] { run(i); });
+    }
+  }
+}
+
+void registerWritePort(const volatile void *address,
+                       std::function<void(uint32_t, uint64_t)> write) {
+  writePorts()[reinterpret_cast<uintptr_t>(address)] = std::move(write);
+}
+
+void registerReadPort(const volatile void *address,
+                      std::function<uint32_t(uint64_t)> read) {
+  readPorts()[reinterpret_cast<uintptr_t>(address)] = std::move(read);
+}
+
+} // namespace pico_host
@@ -0,0 +1,214 @@
+#include "hardware/gpio.h"
+
+#include <array>
+#include <cstdlib>
+#include <optional>
+#include <vector>
+
+#include "sim.h"
+
+namespace {
+
+struct Pin {
+  gpio_function function = GPIO_FUNC_NULL;
+  bool out = false;
+  bool level = false;
+  bool pullUp = false;
+  bool pullDown = true;
+  std::function<bool(uint64_t)> source;
+  std::optional<bool> driven;
+  uint32_t irqMask = 0;
+  uint32_t irqEvents = 0;
+};
+
+std::array<Pin, NUM_BANK0_GPIOS> pins;
+gpio_irq_callback_t irqCallback = nullptr;
+// Pins whose events a raw handler takes care of.
+uint32_t rawIrqMask = 0;
+
+// What the SDK's default IO_IRQ_BANK0 handler does.
+void defaultIrqHandler() {
+  for (uint gpio = 0; gpio < NUM_BANK0_GPIOS; ++gpio) {
+    if (rawIrqMask & (1u << gpio)) {
+      continue;
+    }
+    const uint32_t events = gpio_get_irq_event_mask(gpio);
+    if (events != 0) {
+      gpio_acknowledge_irq(gpio, events);
+      if (irqCallback != nullptr) {
+        irqCallback(gpio, events);
+      }
+    }
+  }
+}
+
+// PICO_HOST_GPIO_PRESSES is a comma-separated list of pin@ms+holdMs: the pin
+// reads high from that time for that long (100 ms without +holdMs), like a
+// button wired to 3V3 being pressed. With PICO_HOST_GPIO_BOUNCE_US every
+// edge also bounces back and forth once within that time.
+void addPressesFromEnvironment() {
+  const char *list = std::getenv("PICO_HOST_GPIO_PRESSES");
+  if (list == nullptr) {
+    return;
+  }
+  const char *bounceValue = std::getenv("PICO_HOST_GPIO_BOUNCE_US");
+  const uint64_t bounceUs =
+      bounceValue == nullptr ? 0 : std::strtoull(bounceValue, nullptr, 10);
+  const auto edge = [bounceUs](uint pin, uint64_t timeUs, bool level) {
+    pico_host::schedule(timeUs, [=] { pico_host::setGpioLevel(pin, level); });
+    if (bounceUs > 0) {
+      pico_host::schedule(timeUs + bounceUs / 3, [=] {
+        pico_host::setGpioLevel(pin, !level);
+      });
+      pico_host::schedule(timeUs + 2 * bounceUs / 3, [=] {
+        pico_host::setGpioLevel(pin, level);
+      });
+    }
+  };
+  for (char *end = nullptr;; list = end + 1) {
+    const uint pin = std::strtoul(list, &end, 10);
+    if (end == list || *end != '@') {
+      break;
+    }
+    const uint64_t startMs = std::strtoull(end + 1, &end, 10);
+    uint64_t holdMs = 100;
+    if (*end == '+') {
+      holdMs = std::strtoull(end + 1, &end, 10);
+    }
+    edge(pin, startMs * 1000, true);
+    edge(pin, (startMs + holdMs) * 1000, false);
+    if (*end != ',') {
+      break;
+    }
+  }
+}
+
+} // namespace
+
+void gpio_init(uint gpio) {
+  static bool pressesAdded = false;
+  if (!pressesAdded) {
+    pressesAdded = true;
+    addPressesFromEnvironment();
+  }
+  auto &pin = pins[gpio];
+  pin.function = GPIO_FUNC_SIO;
+  pin.out = false;
+  pin.level = false;
+  pico_host::record(pico_host::Op::GpioInit, gpio);
+}
+
+void gpio_set_function(uint gpio, gpio_function fn) {
+  pins[gpio].function = fn;
+  pico_host::record(pico_host::Op::GpioSetFunction, gpio, fn);
+}
+
+gpio_function gpio_get_function(uint gpio) { return pins[gpio].function; }
+
+void gpio_set_dir(uint gpio, bool out) {
+  pins[gpio].out = out;
+  pico_host::record(pico_host::Op::GpioSetDir, gpio, out);
+}
+
+bool gpio_is_dir_out(uint gpio) { return pins[gpio].out; }
+
+void gpio_put(uint gpio, bool value) {
+  pins[gpio].level = value;
+  pico_host::record(pico_host::Op::GpioPut, gpio, value);
+}
+
+bool gpio_get(uint gpio) {
+  const auto &pin = pins[gpio];
+  if (pin.function == GPIO_FUNC_SIO && pin.out) {
+    return pin.level;
+  }
+  if (pin.driven) {
+    return *pin.driven;
+  }
+  if (pin.source) {
+    return pin.source(pico_host::now());
+  }
+  // Nothing drives the pad, so it reads whatever the pulls settle to.
+  return pin.pullUp;
+}
+
+bool gpio_get_out_level(uint gpio) { return pins[gpio].level; }
+
+void gpio_set_pulls(uint gpio, bool up, bool down) {
+  pins[gpio].pullUp = up;
+  pins[gpio].pullDown = down;
+  pico_host::record(pico_host::Op::GpioSetPulls, gpio, up, down);
+}
+
+void gpio_set_irq_enabled(uint gpio, uint32_t event_mask, bool enabled) {
+  auto &pin = pins[gpio];
+  // Enabling clears stale edges, as the SDK does.
+  gpio_acknowledge_irq(gpio, event_mask);
+  if (enabled) {
+    pin.irqMask |= event_mask;
+  } else {
+    pin.irqMask &= ~event_mask;
+  }
+}
+
+void gpio_set_irq_callback(gpio_irq_callback_t callback) {
+  if (irqCallback == nullptr) {
+    irq_add_shared_handler(IO_IRQ_BANK0, defaultIrqHandler,
+                           PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+  }
+  irqCallback = callback;
+}
+
+void gpio_set_irq_enabled_with_callback(uint gpio, uint32_t event_mask,
+                                        bool enabled,
+                                        gpio_irq_callback_t callback) {
+  gpio_set_irq_enabled(gpio, event_mask, enabled);
+  gpio_set_irq_callback(callback);
+  if (enabled) {
+    irq_set_enabled(IO_IRQ_BANK0, true);
+  }
+}
+
+void gpio_add_raw_irq_handler_masked(uint32_t gpio_mask,
+                                     irq_handler_t handler) {
+  rawIrqMask |= gpio_mask;
+  irq_add_shared_handler(IO_IRQ_BANK0, handler,
+                         PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+}
+
+void gpio_remove_raw_irq_handler_masked(uint32_t gpio_mask,
+                                        irq_handler_t handler) {
+  rawIrqMask &= ~gpio_mask;
+  irq_remove_handler(IO_IRQ_BANK0, handler);
+}
+
+uint32_t gpio_get_irq_event_mask(uint gpio) {
+  const auto &pin = pins[gpio];
+  return pin.irqEvents & pin.irqMask;
+}
+
+void gpio_acknowledge_irq(uint gpio, uint32_t event_mask) {
+  pins[gpio].irqEvents &= ~event_mask;
+}
+
+namespace pico_host {
+
+void setGpioInput(uint pin, std::function<bool(uint64_t timeUs)> source) {
+  pins[pin].source = std::move(source);
+  pins[pin].driven.reset();
+}
+
+void setGpioLevel(uint pin, bool level) {
+  auto &state = pins[pin];
+  const bool before = gpio_get(pin);
+  state.driven = level;
+  if (before == level) {
+    return;
+  }
+  state.irqEvents |= level ? GPIO_IRQ_EDGE_RISE : GPIO_IRQ_EDGE_FALL;
+  if (gpio_get_irq_event_mask(pin) != 0) {
+    raiseIrq(IO_IRQ_BANK0);
+  }
+}
+
+} // namespace pico_host
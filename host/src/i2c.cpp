@@ -0,0 +1,130 @@
+#include "hardware/i2c.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <vector>
+
+#include "sim.h"
+
+namespace {
+
+constexpr uint kTxFifoDepth = 16;
+constexpr uint32_t kIdleStatus = I2C_IC_STATUS_TFE_BITS |
+                                 I2C_IC_STATUS_TFNF_BITS;
+
+struct Controller {
+  i2c_hw_t hw = {0, 0, 0, kIdleStatus};
+  // When the last byte queued for the wire will have been clocked out.
+  uint64_t busyUntilNs = 0;
+  uint64_t idleEvent = 0;
+  // Bytes written to DATA_CMD since the last STOP, and when they started.
+  std::vector<uint8_t> pending;
+  uint64_t pendingStartNs = 0;
+};
+
+std::array<Controller, 2> controllers;
+
+// Every byte is 8 data bits plus ACK; a transfer adds the address byte and
+// roughly two bit times for START and STOP.
+uint64_t transferUs(const i2c_inst_t *i2c, size_t len) {
+  return pico_host::bitTimeUs((len + 1) * 9 + 2, i2c->baudrate);
+}
+
+uint64_t byteTimeNs(const i2c_inst_t *i2c) {
+  return 9'000'000'000ull / i2c->baudrate;
+}
+
+void flush(Controller &controller) {
+  pico_host::recordAt(controller.pendingStartNs / 1000,
+                      pico_host::Op::I2cWrite, controller.hw.tar,
+                      controller.pending.size(), 0, controller.pending.data(),
+                      controller.pending.size());
+  controller.pending.clear();
+}
+
+// DATA_CMD written by DMA: bytes go out at the bus rate, the transaction is
+// logged once STOP (or a RESTART of the next one) is seen.
+void writeDataCmd(i2c_inst_t *i2c, uint32_t value, uint64_t timeNs) {
+  auto &controller = controllers[i2c_get_index(i2c)];
+  if ((value & I2C_IC_DATA_CMD_RESTART_BITS) && !controller.pending.empty()) {
+    flush(controller);
+  }
+  if (controller.pending.empty()) {
+    controller.pendingStartNs = timeNs;
+  }
+  controller.pending.push_back(value & I2C_IC_DATA_CMD_DAT_BITS);
+  if (value & I2C_IC_DATA_CMD_STOP_BITS) {
+    flush(controller);
+  }
+}
+
+// STATUS shows the controller active until the last queued byte is out.
+void markBusy(Controller &controller) {
+  controller.hw.status = I2C_IC_STATUS_ACTIVITY_BITS | I2C_IC_STATUS_TFNF_BITS;
+  if (controller.idleEvent != 0) {
+    pico_host::cancel(controller.idleEvent);
+  }
+  controller.idleEvent = pico_host::schedule(
+      (controller.busyUntilNs + 999) / 1000, [&controller] {
+        controller.idleEvent = 0;
+        controller.hw.status = kIdleStatus;
+      });
+}
+
+// Earliest time the TX FIFO has room for another byte.
+uint64_t paceTx(i2c_inst_t *i2c, uint64_t earliestNs) {
+  auto &controller = controllers[i2c_get_index(i2c)];
+  const uint64_t byteNs = byteTimeNs(i2c);
+  const uint64_t capacityNs = kTxFifoDepth * byteNs;
+  uint64_t acceptedNs = earliestNs;
+  if (controller.busyUntilNs > acceptedNs + capacityNs) {
+    acceptedNs = controller.busyUntilNs - capacityNs;
+  }
+  controller.busyUntilNs =
+      std::max(controller.busyUntilNs, acceptedNs) + byteNs;
+  markBusy(controller);
+  return acceptedNs;
+}
+
+} // namespace
+
+i2c_inst_t i2c0_inst = {&controllers[0].hw, 100'000};
+i2c_inst_t i2c1_inst = {&controllers[1].hw, 100'000};
+
+uint i2c_init(i2c_inst_t *i2c, uint baudrate) {
+  i2c->baudrate = baudrate;
+  i2c->hw->enable = 1;
+  pico_host::registerDreq(i2c_get_dreq(i2c, true), [i2c](uint64_t earliestNs) {
+    return paceTx(i2c, earliestNs);
+  });
+  pico_host::registerWritePort(&i2c->hw->data_cmd,
+                               [i2c](uint32_t value, uint64_t timeNs) {
+                                 writeDataCmd(i2c, value, timeNs);
+                               });
+  pico_host::record(pico_host::Op::I2cInit, i2c_get_index(i2c), baudrate);
+  return baudrate;
+}
+
+void i2c_deinit(i2c_inst_t *i2c) { i2c->hw->enable = 0; }
+
+uint i2c_get_index(i2c_inst_t *i2c) { return i2c == i2c1 ? 1 : 0; }
+
+int i2c_write_blocking(i2c_inst_t *i2c, uint8_t addr, const uint8_t *src,
+                       size_t len, bool nostop) {
+  auto &controller = controllers[i2c_get_index(i2c)];
+  // Wait for anything DMA still has queued on the bus.
+  pico_host::advanceTo((controller.busyUntilNs + 999) / 1000);
+  i2c->hw->tar = addr;
+  pico_host::record(pico_host::Op::I2cWrite, addr, len, nostop, src, len);
+  pico_host::advanceBy(transferUs(i2c, len));
+  controller.busyUntilNs = pico_host::now() * 1000;
+  return static_cast<int>(len);
+}
+
+int i2c_read_blocking(i2c_inst_t *i2c, uint8_t addr, uint8_t *dst, size_t len,
+                      bool nostop) {
+  std::memset(dst, 0, len);
+  pico_host::advanceBy(transferUs(i2c, len));
+  return static_cast<int>(len);
+}
@@ -0,0 +1,70 @@
+#include <array>
+#include <vector>
+
+#include "hardware/clocks.h"
+#include "hardware/irq.h"
+#include "pico/stdlib.h"
+#include "sim.h"
+
+namespace {
+
+std::array<std::vector<irq_handler_t>, NUM_IRQS> handlers;
+std::array<bool, NUM_IRQS> enabled = {};
+
+} // namespace
+
+bool stdio_init_all() { return true; }
+
+uint32_t clock_get_hz(clock_index clk_index) {
+  switch (clk_index) {
+  case clk_sys:
+  case clk_peri:
+    return SYS_CLK_KHZ * 1000;
+  case clk_usb:
+  case clk_adc:
+    return 48'000'000;
+  case clk_ref:
+    return 12'000'000;
+  case clk_rtc:
+    return 46'875;
+  default:
+    return 0;
+  }
+}
+
+void irq_set_enabled(uint num, bool enable) { enabled[num] = enable; }
+
+bool irq_is_enabled(uint num) { return enabled[num]; }
+
+void irq_set_exclusive_handler(uint num, irq_handler_t handler) {
+  hard_assert(handlers[num].empty());
+  handlers[num].push_back(handler);
+}
+
+void irq_add_shared_handler(uint num, irq_handler_t handler,
+                            uint8_t order_priority) {
+  handlers[num].push_back(handler);
+}
+
+void irq_remove_handler(uint num, irq_handler_t handler) {
+  auto &list = handlers[num];
+  for (auto it = list.begin(); it != list.end(); ++it) {
+    if (*it == handler) {
+      list.erase(it);
+      return;
+    }
+  }
+}
+
+namespace pico_host {
+
+void raiseIrq(uint num) {
+  if (!enabled[num]) {
+    return;
+  }
+  for (const auto handler : handlers[num]) {
+    handler();
+  }
+}
+
+} // namespace pico_host
@@ -0,0 +1,124 @@
+#include "pico/multicore.h"
+
+#include <array>
+#include <deque>
+#include <vector>
+
+#include <ucontext.h>
+
+#include "hardware/sync.h"
+#include "sim.h"
+
+namespace {
+
+constexpr size_t kFifoDepth = 8;
+constexpr size_t kCore1StackSize = 256 * 1024;
+
+ucontext_t core0Context;
+ucontext_t core1Context;
+std::vector<char> core1Stack;
+void (*core1Entry)() = nullptr;
+bool runningCore1 = false;
+// The event that will hand core 1 the CPU again, if any.
+uint64_t resumeEvent = 0;
+bool core1WaitingForEvent = false;
+
+// Indexed by the receiving core.
+std::array<std::deque<uint32_t>, 2> fifos;
+
+// Runs as a simulator event on core 0's stack, which stays suspended until
+// core 1 yields.
+void resume() {
+  resumeEvent = 0;
+  core1WaitingForEvent = false;
+  runningCore1 = true;
+  swapcontext(&core0Context, &core1Context);
+  runningCore1 = false;
+}
+
+void yieldCore1() { swapcontext(&core1Context, &core0Context); }
+
+void resumeAt(uint64_t timeUs) {
+  if (resumeEvent != 0) {
+    pico_host::cancel(resumeEvent);
+  }
+  resumeEvent = pico_host::schedule(timeUs, resume);
+}
+
+void core1Main() {
+  core1Entry();
+  // Returning from the entry point parks core 1 for good.
+  while (true) {
+    yieldCore1();
+  }
+}
+
+void wakeCore1() {
+  if (core1WaitingForEvent) {
+    core1WaitingForEvent = false;
+    resumeAt(pico_host::now());
+  }
+}
+
+} // namespace
+
+namespace pico_host {
+
+bool onCore1() { return runningCore1; }
+
+void core1SleepUntil(uint64_t timeUs) {
+  resumeAt(timeUs);
+  yieldCore1();
+}
+
+void core1WaitForEvent() {
+  core1WaitingForEvent = true;
+  if (nextEventTime() != UINT64_MAX) {
+    resumeAt(nextEventTime());
+  }
+  yieldCore1();
+}
+
+} // namespace pico_host
+
+uint get_core_num() { return runningCore1 ? 1 : 0; }
+
+void __sev() { wakeCore1(); }
+
+void multicore_launch_core1(void (*entry)(void)) {
+  core1Entry = entry;
+  core1Stack.resize(kCore1StackSize);
+  getcontext(&core1Context);
+  core1Context.uc_stack.ss_sp = core1Stack.data();
+  core1Context.uc_stack.ss_size = core1Stack.size();
+  core1Context.uc_link = nullptr;
+  makecontext(&core1Context, core1Main, 0);
+  resumeAt(pico_host::now());
+}
+
+bool multicore_fifo_rvalid() { return !fifos[get_core_num()].empty(); }
+
+bool multicore_fifo_wready() {
+  return fifos[1 - get_core_num()].size() < kFifoDepth;
+}
+
+void multicore_fifo_push_blocking(uint32_t data) {
+  while (!multicore_fifo_wready()) {
+    __wfe();
+  }
+  fifos[1 - get_core_num()].push_back(data);
+  __sev();
+}
+
+uint32_t multicore_fifo_pop_blocking() {
+  while (!multicore_fifo_rvalid()) {
+    __wfe();
+  }
+  auto &fifo = fifos[get_core_num()];
+  const uint32_t data = fifo.front();
+  fifo.pop_front();
+  __sev();
+  return data;
+}
+
+void multicore_fifo_drain() { fifos[get_core_num()].clear(); }
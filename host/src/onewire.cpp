@@ -0,0 +1,364 @@
+#include <array>
+#include <cmath>
+#include <cstdlib>
+#include <map>
+#include <vector>
+
+#include "sim.h"
+
+namespace {
+
+constexpr uint8_t kFamilyDs18b20 = 0x28;
+// What the temperature register holds after power-up: 85 °C.
+constexpr uint16_t kPowerOnReset = 0x0550;
+
+uint8_t crc8(const uint8_t *data, size_t size) {
+  uint8_t crc = 0;
+  for (size_t i = 0; i < size; ++i) {
+    uint8_t byte = data[i];
+    for (int bit = 0; bit < 8; ++bit) {
+      const bool mix = (crc ^ byte) & 1;
+      crc >>= 1;
+      if (mix) {
+        crc ^= 0x8C;
+      }
+      byte >>= 1;
+    }
+  }
+  return crc;
+}
+
+// One DS18B20, driven a slot at a time. Commands and data arrive and leave
+// LSB first; the device only ever sees the bus level, so several devices on
+// one pin behave like the real wired-AND bus.
+class Ds18b20 {
+public:
+  Ds18b20(uint64_t rom, std::function<float(uint64_t)> celsius)
+      : rom_(rom), celsius_(std::move(celsius)) {
+    scratchpad_[0] = kPowerOnReset & 0xFF;
+    scratchpad_[1] = kPowerOnReset >> 8;
+    scratchpad_[2] = 0x4B; // TH
+    scratchpad_[3] = 0x46; // TL
+    scratchpad_[4] = 0x7F; // 12-bit resolution
+    scratchpad_[5] = 0xFF;
+    scratchpad_[6] = 0x0C;
+    scratchpad_[7] = 0x10;
+    updateCrc();
+  }
+
+  uint64_t rom() const { return rom_; }
+
+  void reset() {
+    state_ = State::RomCommand;
+    startReceive(8);
+  }
+
+  // Level this device leaves the bus at during the slot: 0 when it is
+  // sending a 0 bit.
+  bool output(uint64_t timeUs) {
+    switch (state_) {
+    case State::SearchBit:
+      return romBit(searchIndex_);
+    case State::SearchComplement:
+      return !romBit(searchIndex_);
+    case State::Transmit:
+      return txBits_[txIndex_];
+    case State::Converting:
+      return timeUs >= conversionDoneUs_;
+    default:
+      return true;
+    }
+  }
+
+  void observe(bool level, uint64_t timeUs) {
+    finishConversion(timeUs);
+    switch (state_) {
+    case State::RomCommand:
+    case State::MatchRom:
+    case State::FunctionCommand:
+    case State::Receive:
+      rxValue_ |= uint64_t(level) << rxCount_;
+      if (++rxCount_ == rxExpected_) {
+        received(timeUs);
+      }
+      break;
+    case State::SearchBit:
+      state_ = State::SearchComplement;
+      break;
+    case State::SearchComplement:
+      state_ = State::SearchDirection;
+      break;
+    case State::SearchDirection:
+      if (level != romBit(searchIndex_)) {
+        state_ = State::Idle;
+      } else if (++searchIndex_ == 64) {
+        state_ = State::FunctionCommand;
+        startReceive(8);
+      } else {
+        state_ = State::SearchBit;
+      }
+      break;
+    case State::Transmit:
+      if (++txIndex_ == txBits_.size()) {
+        state_ = State::Idle;
+      }
+      break;
+    default:
+      break;
+    }
+  }
+
+private:
+  enum class State {
+    Idle,
+    RomCommand,
+    SearchBit,
+    SearchComplement,
+    SearchDirection,
+    MatchRom,
+    FunctionCommand,
+    Receive,
+    Transmit,
+    Converting,
+  };
+
+  bool romBit(int index) const { return (rom_ >> index) & 1; }
+
+  void startReceive(int bits) {
+    rxValue_ = 0;
+    rxCount_ = 0;
+    rxExpected_ = bits;
+  }
+
+  void transmit(const uint8_t *bytes, size_t size) {
+    txBits_.clear();
+    for (size_t i = 0; i < size; ++i) {
+      for (int bit = 0; bit < 8; ++bit) {
+        txBits_.push_back((bytes[i] >> bit) & 1);
+      }
+    }
+    txIndex_ = 0;
+    state_ = State::Transmit;
+  }
+
+  void received(uint64_t timeUs) {
+    const uint64_t value = rxValue_;
+    switch (state_) {
+    case State::RomCommand:
+      romCommand(value);
+      break;
+    case State::MatchRom:
+      state_ = value == rom_ ? State::FunctionCommand : State::Idle;
+      startReceive(8);
+      break;
+    case State::FunctionCommand:
+      functionCommand(value, timeUs);
+      break;
+    case State::Receive:
+      // WRITE SCRATCHPAD: TH, TL and the configuration register.
+      scratchpad_[2] = value & 0xFF;
+      scratchpad_[3] = (value >> 8) & 0xFF;
+      scratchpad_[4] = ((value >> 16) & 0x60) | 0x1F;
+      updateCrc();
+      state_ = State::Idle;
+      break;
+    default:
+      break;
+    }
+  }
+
+  void romCommand(uint8_t command) {
+    switch (command) {
+    case 0x33: { // READ ROM
+      uint8_t bytes[8];
+      for (int i = 0; i < 8; ++i) {
+        bytes[i] = rom_ >> (8 * i);
+      }
+      transmit(bytes, sizeof(bytes));
+      break;
+    }
+    case 0x55: // MATCH ROM
+      state_ = State::MatchRom;
+      startReceive(64);
+      break;
+    case 0xCC: // SKIP ROM
+      state_ = State::FunctionCommand;
+      startReceive(8);
+      break;
+    case 0xF0: // SEARCH ROM
+      state_ = State::SearchBit;
+      searchIndex_ = 0;
+      break;
+    default: // ALARM SEARCH and the rest: never alarming, stay quiet.
+      state_ = State::Idle;
+      break;
+    }
+  }
+
+  void functionCommand(uint8_t command, uint64_t timeUs) {
+    switch (command) {
+    case 0x44: // CONVERT T
+      conversionDoneUs_ = timeUs + conversionTimeUs();
+      state_ = State::Converting;
+      break;
+    case 0xBE: // READ SCRATCHPAD
+      transmit(scratchpad_.data(), scratchpad_.size());
+      break;
+    case 0x4E: // WRITE SCRATCHPAD
+      state_ = State::Receive;
+      startReceive(24);
+      break;
+    case 0xB4: { // READ POWER SUPPLY: externally powered.
+      const uint8_t one = 0xFF;
+      transmit(&one, 1);
+      break;
+    }
+    default: // COPY/RECALL: no EEPROM to speak of.
+      state_ = State::Idle;
+      break;
+    }
+  }
+
+  uint64_t conversionTimeUs() const {
+    const int resolutionBits = 9 + ((scratchpad_[4] >> 5) & 3);
+    return 93'750ull << (resolutionBits - 9);
+  }
+
+  // The result lands in the scratchpad when the conversion ends, whether or
+  // not the master is still polling for it.
+  void finishConversion(uint64_t timeUs) {
+    if (conversionDoneUs_ == 0 || timeUs < conversionDoneUs_) {
+      return;
+    }
+    const int resolutionBits = 9 + ((scratchpad_[4] >> 5) & 3);
+    const int dropped = 12 - resolutionBits;
+    int raw = static_cast<int>(std::lround(celsius_(conversionDoneUs_) * 16));
+    raw = raw / (1 << dropped) * (1 << dropped);
+    scratchpad_[0] = raw & 0xFF;
+    scratchpad_[1] = (raw >> 8) & 0xFF;
+    updateCrc();
+    conversionDoneUs_ = 0;
+    if (state_ == State::Converting) {
+      state_ = State::Idle;
+    }
+  }
+
+  void updateCrc() { scratchpad_[8] = crc8(scratchpad_.data(), 8); }
+
+  const uint64_t rom_;
+  const std::function<float(uint64_t)> celsius_;
+  std::array<uint8_t, 9> scratchpad_ = {};
+
+  State state_ = State::Idle;
+  uint64_t rxValue_ = 0;
+  int rxCount_ = 0;
+  int rxExpected_ = 0;
+  std::vector<bool> txBits_;
+  size_t txIndex_ = 0;
+  int searchIndex_ = 0;
+  uint64_t conversionDoneUs_ = 0;
+};
+
+uint64_t makeRom(uint64_t serial) {
+  uint8_t bytes[8] = {kFamilyDs18b20};
+  for (int i = 1; i < 7; ++i) {
+    bytes[i] = serial >> (8 * (i - 1));
+  }
+  bytes[7] = crc8(bytes, 7);
+  uint64_t rom = 0;
+  for (int i = 0; i < 8; ++i) {
+    rom |= uint64_t(bytes[i]) << (8 * i);
+  }
+  return rom;
+}
+
+// PICO_HOST_DS18B20 is a comma-separated list of pins, one device per entry,
+// e.g. "26,26" for two sensors on GPIO 26. Each one drifts slowly around a
+// slightly different temperature.
+void addFromEnvironment(std::map<uint, std::vector<Ds18b20>> &buses) {
+  const char *list = std::getenv("PICO_HOST_DS18B20");
+  if (list == nullptr) {
+    return;
+  }
+  int index = 0;
+  for (char *end = nullptr;; list = end + 1) {
+    const uint pin = std::strtoul(list, &end, 10);
+    if (end == list) {
+      break;
+    }
+    const float base = 21.0f + 1.5f * index;
+    buses[pin].emplace_back(
+        makeRom(0x5EED00 + 0x010203 * index), [base](uint64_t timeUs) {
+          return base + 2.0f * std::sin(timeUs * 2 * M_PI / 60e6);
+        });
+    ++index;
+    if (*end != ',') {
+      break;
+    }
+  }
+}
+
+// PICO_HOST_ONEWIRE_NOISE is the chance, 0 to 1, that a read slot comes back
+// flipped, as a long cable picking up interference would. The sequence is
+// the same on every run.
+bool noisy() {
+  static const double chance = [] {
+    const char *value = std::getenv("PICO_HOST_ONEWIRE_NOISE");
+    return value == nullptr ? 0.0 : std::atof(value);
+  }();
+  if (chance <= 0) {
+    return false;
+  }
+  static uint32_t state = 1;
+  state = state * 1664525 + 1013904223;
+  return (state >> 8) < chance * (1u << 24);
+}
+
+auto &buses() {
+  static std::map<uint, std::vector<Ds18b20>> buses = [] {
+    std::map<uint, std::vector<Ds18b20>> buses;
+    addFromEnvironment(buses);
+    return buses;
+  }();
+  return buses;
+}
+
+} // namespace
+
+namespace pico_host {
+
+void addDs18b20(uint pin, uint64_t rom,
+                std::function<float(uint64_t timeUs)> celsius) {
+  buses()[pin].emplace_back(rom, std::move(celsius));
+}
+
+bool oneWireReset(uint pin, uint64_t timeUs) {
+  const auto bus = buses().find(pin);
+  const bool present = bus != buses().end() && !bus->second.empty();
+  if (present) {
+    for (auto &device : bus->second) {
+      device.reset();
+    }
+  }
+  recordAt(timeUs, Op::OneWireReset, pin, present);
+  return present;
+}
+
+bool oneWireSlot(uint pin, bool bit, uint64_t timeUs) {
+  const auto bus = buses().find(pin);
+  if (bus == buses().end()) {
+    return bit;
+  }
+  bool level = bit;
+  for (auto &device : bus->second) {
+    level = level && device.output(timeUs);
+  }
+  for (auto &device : bus->second) {
+    device.observe(level, timeUs);
+  }
+  // Only what the master samples is disturbed; the devices saw the real
+  // level.
+  return bit && noisy() ? !level : level;
+}
+
+} // namespace pico_host
@@ -0,0 +1,386 @@
+#include "hardware/pio.h"
+
+#include <algorithm>
+#include <array>
+#include <deque>
+
+#include "hardware/clocks.h"
+#include "sim.h"
+
+namespace {
+
+constexpr uint kInstructionMemorySize = 32;
+
+struct RxWord {
+  uint64_t readyNs;
+  uint32_t value;
+};
+
+struct StateMachine {
+  bool claimed = false;
+  bool enabled = false;
+  pio_sm_config config = {};
+  // When the last word pushed into the TX FIFO will have been shifted out.
+  uint64_t drainedAtNs = 0;
+  // When the state machine pulls each word DMA has been promised room for
+  // but not written yet.
+  std::deque<uint64_t> acceptedStartNs;
+  // Words the program pushed, and how many of them DMA has been promised.
+  // The RX FIFO never fills here, so a program is never stalled on it.
+  std::deque<RxWord> rx;
+  size_t rxPaced = 0;
+};
+
+struct Block {
+  uint index;
+  uint32_t usedInstructions;
+  std::array<StateMachine, NUM_PIO_STATE_MACHINES> sms;
+};
+
+std::array<Block, NUM_PIOS> blocks = {{{0, 0, {}}, {1, 0, {}}}};
+
+} // namespace
+
+pio_hw_t pio0_hw = {};
+pio_hw_t pio1_hw = {};
+
+namespace {
+
+Block &block(PIO pio) { return blocks[pio == pio1 ? 1 : 0]; }
+
+uint32_t programMask(const pio_program_t *program) {
+  return (1u << program->length) - 1;
+}
+
+int findOffset(PIO pio, const pio_program_t *program) {
+  const uint32_t mask = programMask(program);
+  const uint32_t used = block(pio).usedInstructions;
+  if (program->origin >= 0) {
+    const bool taken = used & (mask << program->origin);
+    return taken ? -1 : program->origin;
+  }
+  // Like the SDK, prefer the top of instruction memory.
+  for (int offset = kInstructionMemorySize - program->length; offset >= 0;
+       --offset) {
+    if (!(used & (mask << offset))) {
+      return offset;
+    }
+  }
+  return -1;
+}
+
+uint64_t wordTimeNs(const pio_sm_config &config) {
+  const uint bits = config.pull_threshold ? config.pull_threshold : 32;
+  const uint cycles = config.host_cycles_per_bit ? config.host_cycles_per_bit
+                                                 : 1;
+  const uint width = config.host_out_width ? config.host_out_width : 1;
+  return static_cast<uint64_t>(1e9 * bits * cycles * config.clkdiv /
+                               (width * clock_get_hz(clk_sys)));
+}
+
+uint fifoDepth(const pio_sm_config &config) {
+  return config.join == PIO_FIFO_JOIN_TX ? 2 * PIO_FIFO_DEPTH
+                                         : PIO_FIFO_DEPTH;
+}
+
+// Words still waiting in the TX FIFO, not counting the one being shifted out.
+uint queuedWords(const StateMachine &sm) {
+  const uint64_t nowNs = pico_host::now() * 1000;
+  if (sm.drainedAtNs <= nowNs) {
+    return 0;
+  }
+  const uint64_t wordNs = std::max<uint64_t>(wordTimeNs(sm.config), 1);
+  const uint64_t inFlight = (sm.drainedAtNs - nowNs + wordNs - 1) / wordNs;
+  return static_cast<uint>(inFlight - 1);
+}
+
+uint64_t nowNs() { return pico_host::now() * 1000; }
+
+// Makes room for one more TX word offered at |earliestNs|: returns when the
+// FIFO accepts it and remembers when the state machine will pull it.
+uint64_t acceptTx(StateMachine &sm, uint64_t earliestNs) {
+  const uint64_t wordNs = wordTimeNs(sm.config);
+  const uint64_t capacityNs = fifoDepth(sm.config) * wordNs;
+  uint64_t acceptedNs = earliestNs;
+  if (sm.drainedAtNs > acceptedNs + capacityNs) {
+    acceptedNs = sm.drainedAtNs - capacityNs;
+  }
+  const uint64_t startNs = std::max(sm.drainedAtNs, acceptedNs);
+  sm.drainedAtNs = startNs + wordNs;
+  sm.acceptedStartNs.push_back(startNs);
+  return acceptedNs;
+}
+
+void pushRx(PIO pio, uint index, uint64_t readyNs, uint32_t value) {
+  block(pio).sms[index].rx.push_back({readyNs, value});
+  pico_host::recordAt(readyNs / 1000, pico_host::Op::PioPush,
+                      pio_get_index(pio), index, value);
+  pico_host::signalDreq(pio_get_dreq(pio, index, false));
+}
+
+// A word accepted by acceptTx() lands in the FIFO.
+void writeTx(PIO pio, uint index, uint32_t word, uint64_t timeNs) {
+  auto &sm = block(pio).sms[index];
+  if (sm.acceptedStartNs.empty()) {
+    acceptTx(sm, timeNs);
+  }
+  const uint64_t startNs = sm.acceptedStartNs.front();
+  sm.acceptedStartNs.pop_front();
+  pico_host::recordAt(timeNs / 1000, pico_host::Op::PioPut, pio_get_index(pio),
+                      index, word);
+  const auto *program = sm.config.host_program;
+  uint32_t rx = 0;
+  if (program != nullptr && program->shift != nullptr &&
+      program->shift(&sm.config, word, startNs, &rx)) {
+    pushRx(pio, index, startNs + wordTimeNs(sm.config), rx);
+  }
+}
+
+uint64_t paceRx(StateMachine &sm, uint64_t earliestNs) {
+  if (sm.rxPaced == sm.rx.size()) {
+    return pico_host::kDreqIdle;
+  }
+  return std::max(earliestNs, sm.rx[sm.rxPaced++].readyNs);
+}
+
+uint32_t popRx(StateMachine &sm) {
+  if (sm.rx.empty()) {
+    return 0;
+  }
+  const uint32_t value = sm.rx.front().value;
+  sm.rx.pop_front();
+  if (sm.rxPaced > 0) {
+    --sm.rxPaced;
+  }
+  return value;
+}
+
+bool rxReady(const StateMachine &sm) {
+  return !sm.rx.empty() && sm.rx.front().readyNs <= nowNs();
+}
+
+} // namespace
+
+pio_sm_config pio_get_default_sm_config() {
+  pio_sm_config c = {};
+  c.clkdiv = 1.f;
+  c.wrap = kInstructionMemorySize - 1;
+  c.out_shift_right = true;
+  c.pull_threshold = 32;
+  c.in_shift_right = true;
+  c.push_threshold = 32;
+  c.host_cycles_per_bit = 1;
+  c.host_out_width = 1;
+  return c;
+}
+
+bool pio_can_add_program(PIO pio, const pio_program_t *program) {
+  return findOffset(pio, program) >= 0;
+}
+
+uint pio_add_program(PIO pio, const pio_program_t *program) {
+  const int offset = findOffset(pio, program);
+  hard_assert(offset >= 0);
+  block(pio).usedInstructions |= programMask(program) << offset;
+  return offset;
+}
+
+void pio_remove_program(PIO pio, const pio_program_t *program, uint offset) {
+  block(pio).usedInstructions &= ~(programMask(program) << offset);
+}
+
+int pio_claim_unused_sm(PIO pio, bool required) {
+  auto &sms = block(pio).sms;
+  for (uint sm = 0; sm < NUM_PIO_STATE_MACHINES; ++sm) {
+    if (!sms[sm].claimed) {
+      sms[sm].claimed = true;
+      return sm;
+    }
+  }
+  hard_assert(!required);
+  return -1;
+}
+
+void pio_sm_unclaim(PIO pio, uint sm) { block(pio).sms[sm].claimed = false; }
+
+bool pio_claim_free_sm_and_add_program_for_gpio_range(
+    const pio_program_t *program, PIO *pio, uint *sm, uint *offset,
+    uint gpio_base, uint gpio_count, bool set_gpio_base) {
+  for (PIO candidate : {pio0, pio1}) {
+    if (!pio_can_add_program(candidate, program)) {
+      continue;
+    }
+    const int claimed = pio_claim_unused_sm(candidate, false);
+    if (claimed < 0) {
+      continue;
+    }
+    *pio = candidate;
+    *sm = claimed;
+    *offset = pio_add_program(candidate, program);
+    return true;
+  }
+  return false;
+}
+
+void pio_remove_program_and_unclaim_sm(const pio_program_t *program, PIO pio,
+                                       uint sm, uint offset) {
+  pio_remove_program(pio, program, offset);
+  pio_sm_unclaim(pio, sm);
+}
+
+void pio_gpio_init(PIO pio, uint pin) {
+  gpio_set_function(pin, pio == pio1 ? GPIO_FUNC_PIO1 : GPIO_FUNC_PIO0);
+}
+
+int pio_sm_set_consecutive_pindirs(PIO pio, uint sm, uint pins_base,
+                                   uint pin_count, bool is_out) {
+  return 0;
+}
+
+void pio_sm_set_pins_with_mask(PIO pio, uint sm, uint32_t pin_values,
+                               uint32_t pin_mask) {}
+
+void pio_sm_set_pindirs_with_mask(PIO pio, uint sm, uint32_t pin_dirs,
+                                  uint32_t pin_mask) {}
+
+int pio_sm_init(PIO pio, uint sm, uint initial_pc,
+                const pio_sm_config *config) {
+  auto &state = block(pio).sms[sm];
+  state.enabled = false;
+  state.config = *config;
+  state.drainedAtNs = 0;
+  state.acceptedStartNs.clear();
+  state.rx.clear();
+  state.rxPaced = 0;
+
+  pico_host::registerDreq(pio_get_dreq(pio, sm, true),
+                          [&state](uint64_t earliestNs) {
+                            return acceptTx(state, earliestNs);
+                          });
+  pico_host::registerWritePort(&pio->txf[sm],
+                               [pio, sm](uint32_t value, uint64_t timeNs) {
+                                 writeTx(pio, sm, value, timeNs);
+                               });
+  pico_host::registerDreq(pio_get_dreq(pio, sm, false),
+                          [&state](uint64_t earliestNs) {
+                            return paceRx(state, earliestNs);
+                          });
+  // Byte and halfword reads pick their lane out of the word, so DMA can
+  // read e.g. the top byte of a left-justified autopush.
+  const auto *rxf = reinterpret_cast<const volatile uint8_t *>(&pio->rxf[sm]);
+  for (uint lane = 0; lane < 4; ++lane) {
+    pico_host::registerReadPort(rxf + lane, [&state, lane](uint64_t) {
+      return popRx(state) >> (8 * lane);
+    });
+  }
+
+  pico_host::record(pico_host::Op::PioSmInit, pio_get_index(pio), sm,
+                    initial_pc);
+  return 0;
+}
+
+int pio_sm_set_config(PIO pio, uint sm, const pio_sm_config *config) {
+  block(pio).sms[sm].config = *config;
+  return 0;
+}
+
+void pio_sm_restart(PIO pio, uint sm) {}
+
+void pio_sm_set_enabled(PIO pio, uint sm, bool enabled) {
+  block(pio).sms[sm].enabled = enabled;
+  pico_host::record(pico_host::Op::PioSmSetEnabled, pio_get_index(pio), sm,
+                    enabled);
+}
+
+void pio_sm_clear_fifos(PIO pio, uint sm) {
+  auto &state = block(pio).sms[sm];
+  state.drainedAtNs = nowNs();
+  state.acceptedStartNs.clear();
+  state.rx.clear();
+  state.rxPaced = 0;
+}
+
+void pio_sm_exec(PIO pio, uint sm, uint instr) {
+  auto &state = block(pio).sms[sm];
+  pico_host::record(pico_host::Op::PioExec, pio_get_index(pio), sm, instr);
+  const auto *program = state.config.host_program;
+  if (program == nullptr || program->exec == nullptr) {
+    return;
+  }
+  // Forced instructions are only modelled for an idle state machine, so
+  // this runs after whatever is still queued.
+  const uint64_t startNs = std::max(state.drainedAtNs, nowNs());
+  bool pushed = false;
+  uint32_t rx = 0;
+  state.drainedAtNs =
+      startNs + program->exec(&state.config, instr, startNs, &pushed, &rx);
+  if (pushed) {
+    pushRx(pio, sm, state.drainedAtNs, rx);
+  }
+}
+
+void pio_sm_exec_wait_blocking(PIO pio, uint sm, uint instr) {
+  pio_sm_exec(pio, sm, instr);
+}
+
+uint pio_get_index(PIO pio) { return block(pio).index; }
+
+uint pio_get_dreq(PIO pio, uint sm, bool is_tx) {
+  return pio_get_index(pio) * 8 + (is_tx ? 0 : 4) + sm;
+}
+
+bool pio_sm_is_tx_fifo_full(PIO pio, uint sm) {
+  const auto &state = block(pio).sms[sm];
+  return queuedWords(state) >= fifoDepth(state.config);
+}
+
+bool pio_sm_is_tx_fifo_empty(PIO pio, uint sm) {
+  return queuedWords(block(pio).sms[sm]) == 0;
+}
+
+uint pio_sm_get_tx_fifo_level(PIO pio, uint sm) {
+  return queuedWords(block(pio).sms[sm]);
+}
+
+void pio_sm_put(PIO pio, uint sm, uint32_t data) {
+  acceptTx(block(pio).sms[sm], nowNs());
+  writeTx(pio, sm, data, nowNs());
+}
+
+void pio_sm_put_blocking(PIO pio, uint sm, uint32_t data) {
+  // FIFO full: stall until the state machine pulls the oldest word.
+  const uint64_t acceptedNs = acceptTx(block(pio).sms[sm], nowNs());
+  pico_host::advanceTo((acceptedNs + 999) / 1000);
+  writeTx(pio, sm, data, nowNs());
+}
+
+bool pio_sm_is_rx_fifo_empty(PIO pio, uint sm) {
+  return !rxReady(block(pio).sms[sm]);
+}
+
+uint pio_sm_get_rx_fifo_level(PIO pio, uint sm) {
+  const auto &state = block(pio).sms[sm];
+  const uint64_t now = nowNs();
+  uint level = 0;
+  for (const auto &word : state.rx) {
+    if (word.readyNs > now) {
+      break;
+    }
+    ++level;
+  }
+  return level;
+}
+
+uint32_t pio_sm_get(PIO pio, uint sm) { return popRx(block(pio).sms[sm]); }
+
+uint32_t pio_sm_get_blocking(PIO pio, uint sm) {
+  auto &state = block(pio).sms[sm];
+  while (!rxReady(state)) {
+    if (state.rx.empty()) {
+      tight_loop_contents();
+    } else {
+      pico_host::advanceTo((state.rx.front().readyNs + 999) / 1000);
+    }
+  }
+  return popRx(state);
+}
@@ -0,0 +1,99 @@
+#include "hardware/pwm.h"
+
+#include <algorithm>
+#include <array>
+
+#include "hardware/clocks.h"
+
+#include "sim.h"
+
+namespace {
+
+struct Slice {
+  float divider = 1.f;
+  uint16_t wrap = 0xffff;
+  std::array<uint16_t, 2> levels = {};
+  bool enabled = false;
+  // Counter wraps fall on this grid while the slice is enabled.
+  uint64_t enabledAtNs = 0;
+};
+
+std::array<Slice, NUM_PWM_SLICES> slices;
+pwm_hw_t registers;
+
+// The trace stores the divider in 8.4 fixed point, like the DIV register.
+uint32_t toFixed(float divider) { return static_cast<uint32_t>(divider * 16); }
+
+uint64_t wrapPeriodNs(const Slice &slice) {
+  return static_cast<uint64_t>(1e9 * (slice.wrap + 1) * slice.divider /
+                               clock_get_hz(clk_sys));
+}
+
+uint64_t paceWrap(uint slice_num, uint64_t earliestNs) {
+  const Slice &slice = slices[slice_num];
+  if (!slice.enabled) {
+    return pico_host::kDreqIdle;
+  }
+  const uint64_t period = std::max<uint64_t>(wrapPeriodNs(slice), 1);
+  const uint64_t sinceNs =
+      earliestNs > slice.enabledAtNs ? earliestNs - slice.enabledAtNs : 0;
+  // One request per wrap: the next one strictly after |earliestNs|, which
+  // is when the previous element moved.
+  return slice.enabledAtNs + (sinceNs / period + 1) * period;
+}
+
+void writeCc(uint slice_num, uint32_t value, uint64_t timeNs) {
+  slices[slice_num].levels = {static_cast<uint16_t>(value),
+                              static_cast<uint16_t>(value >> 16)};
+  registers.slice[slice_num].cc = value;
+  pico_host::recordAt(timeNs / 1000, pico_host::Op::PwmSetCc, slice_num,
+                      value);
+}
+
+} // namespace
+
+pwm_hw_t *const pwm_hw = &registers;
+
+void pwm_set_clkdiv(uint slice_num, float divider) {
+  slices[slice_num].divider = divider;
+  pico_host::record(pico_host::Op::PwmSetClkdiv, slice_num, toFixed(divider));
+}
+
+void pwm_set_clkdiv_int_frac(uint slice_num, uint8_t integer, uint8_t fract) {
+  pwm_set_clkdiv(slice_num, integer + fract / 16.f);
+}
+
+void pwm_set_wrap(uint slice_num, uint16_t wrap) {
+  slices[slice_num].wrap = wrap;
+  pico_host::record(pico_host::Op::PwmSetWrap, slice_num, wrap);
+}
+
+void pwm_set_chan_level(uint slice_num, uint chan, uint16_t level) {
+  slices[slice_num].levels[chan] = level;
+  pico_host::record(pico_host::Op::PwmSetLevel, slice_num, chan, level);
+}
+
+void pwm_set_gpio_level(uint gpio, uint16_t level) {
+  pwm_set_chan_level(pwm_gpio_to_slice_num(gpio), pwm_gpio_to_channel(gpio),
+                     level);
+}
+
+void pwm_set_enabled(uint slice_num, bool enabled) {
+  auto &slice = slices[slice_num];
+  if (enabled && !slice.enabled) {
+    slice.enabledAtNs = pico_host::now() * 1000;
+    pico_host::registerDreq(pwm_get_dreq(slice_num),
+                            [slice_num](uint64_t earliestNs) {
+                              return paceWrap(slice_num, earliestNs);
+                            });
+    pico_host::registerWritePort(&registers.slice[slice_num].cc,
+                                 [slice_num](uint32_t value, uint64_t timeNs) {
+                                   writeCc(slice_num, value, timeNs);
+                                 });
+  }
+  slice.enabled = enabled;
+  if (enabled) {
+    pico_host::signalDreq(pwm_get_dreq(slice_num));
+  }
+  pico_host::record(pico_host::Op::PwmSetEnabled, slice_num, enabled);
+}
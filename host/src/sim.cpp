@@ -0,0 +1,285 @@
+#include "sim.h"
+
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <unordered_map>
+
+namespace pico_host {
+namespace {
+
+constexpr size_t kNumOps = static_cast<size_t>(Op::PwmSetCc) + 1;
+
+class Simulator {
+public:
+  Simulator() : realStart_(std::chrono::steady_clock::now()) {
+    if (const char *limit = std::getenv("PICO_HOST_RUN_MS")) {
+      runLimitUs_ = 1000ull * std::strtoull(limit, nullptr, 10);
+    }
+    if (const char *clock = std::getenv("PICO_HOST_CLOCK")) {
+      // "hybrid" adds the real time spent computing on the host to the
+      // virtual clock, so CPU-bound code shows up in time_us_64() deltas.
+      hybridClock_ = std::strcmp(clock, "hybrid") == 0;
+    }
+    if (const char *path = std::getenv("PICO_HOST_TRACE")) {
+      tracePath_ = path;
+      tracing_ = true;
+    }
+  }
+
+  static Simulator &instance() {
+    // Never destroyed: the exit report must still see it, and so must any
+    // firmware code that runs from other static destructors.
+    static Simulator *simulator = [] {
+      auto *simulator = new Simulator;
+      std::atexit([] { instance().report(); });
+      return simulator;
+    }();
+    return *simulator;
+  }
+
+  uint64_t now() const { return skewUs_ + realUs(); }
+
+  void advanceTo(uint64_t timeUs) {
+    if (onCore1()) {
+      core1SleepUntil(timeUs);
+      return;
+    }
+    if (inCallback_) {
+      // Busy-waiting inside a callback: time passes, but nothing else may
+      // preempt it, same as an IRQ handler on the real core.
+      moveClockTo(timeUs);
+      return;
+    }
+    while (!events_.empty() && events_.begin()->first.first <= timeUs) {
+      const auto it = events_.begin();
+      const uint64_t id = it->first.second;
+      moveClockTo(it->first.first);
+      auto callback = std::move(it->second);
+      events_.erase(it);
+      eventTimes_.erase(id);
+      inCallback_ = true;
+      callback();
+      inCallback_ = false;
+    }
+    moveClockTo(timeUs);
+  }
+
+  uint64_t schedule(uint64_t timeUs, std::function<void()> callback) {
+    const uint64_t id = nextEventId_++;
+    events_.emplace(std::make_pair(timeUs, id), std::move(callback));
+    eventTimes_.emplace(id, timeUs);
+    return id;
+  }
+
+  bool cancel(uint64_t id) {
+    const auto it = eventTimes_.find(id);
+    if (it == eventTimes_.end()) {
+      return false;
+    }
+    events_.erase({it->second, id});
+    eventTimes_.erase(it);
+    return true;
+  }
+
+  uint64_t nextEventTime() const {
+    return events_.empty() ? UINT64_MAX : events_.begin()->first.first;
+  }
+
+  void record(uint64_t timeUs, Op op, uint32_t a, uint32_t b, uint32_t c,
+              const uint8_t *payload, size_t size) {
+    ++counts_[static_cast<size_t>(op)];
+    if (!tracing_) {
+      return;
+    }
+    transactions_.push_back({timeUs, op, a, b, c,
+                             static_cast<uint32_t>(payloadPool_.size()),
+                             static_cast<uint32_t>(size)});
+    payloadPool_.insert(payloadPool_.end(), payload, payload + size);
+  }
+
+  void setTracing(bool enabled) { tracing_ = enabled; }
+  void setRunLimitUs(uint64_t limitUs) { runLimitUs_ = limitUs; }
+  uint64_t count(Op op) const { return counts_[static_cast<size_t>(op)]; }
+  const std::vector<Transaction> &transactions() const {
+    return transactions_;
+  }
+  const uint8_t *payload(const Transaction &t) const {
+    return payloadPool_.data() + t.payloadOffset;
+  }
+  void clearTransactions() {
+    transactions_.clear();
+    payloadPool_.clear();
+  }
+
+private:
+  uint64_t realUs() const {
+    if (!hybridClock_) {
+      return 0;
+    }
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now() - realStart_)
+        .count();
+  }
+
+  void moveClockTo(uint64_t timeUs) {
+    const uint64_t current = now();
+    if (timeUs > current) {
+      skewUs_ += timeUs - current;
+    }
+    if (runLimitUs_ != 0 && now() >= runLimitUs_) {
+      std::exit(0);
+    }
+  }
+
+  void report() const {
+    const double realMs =
+        std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - realStart_)
+            .count();
+    fprintf(stderr, "[pico_host] %.3f s virtual in %.1f ms real\n",
+            now() / 1e6, realMs);
+    for (size_t i = 0; i < kNumOps; ++i) {
+      if (counts_[i] != 0) {
+        fprintf(stderr, "[pico_host] %-20s %llu\n",
+                opName(static_cast<Op>(i)),
+                static_cast<unsigned long long>(counts_[i]));
+      }
+    }
+    if (!tracePath_.empty()) {
+      writeTrace();
+    }
+  }
+
+  void writeTrace() const {
+    FILE *file = std::fopen(tracePath_.c_str(), "w");
+    if (file == nullptr) {
+      fprintf(stderr, "[pico_host] cannot open %s\n", tracePath_.c_str());
+      return;
+    }
+    fprintf(file, "time_us,op,a,b,c,payload\n");
+    for (const auto &t : transactions_) {
+      fprintf(file, "%llu,%s,%u,%u,%u,",
+              static_cast<unsigned long long>(t.timeUs), opName(t.op), t.a,
+              t.b, t.c);
+      for (uint32_t i = 0; i < t.payloadSize; ++i) {
+        fprintf(file, "%02X", payloadPool_[t.payloadOffset + i]);
+      }
+      fprintf(file, "\n");
+    }
+    std::fclose(file);
+  }
+
+private:
+  const std::chrono::steady_clock::time_point realStart_;
+  uint64_t skewUs_ = 0;
+  bool hybridClock_ = false;
+  uint64_t runLimitUs_ = 10 * 60 * 1'000'000ull;
+
+  std::map<std::pair<uint64_t, uint64_t>, std::function<void()>> events_;
+  std::unordered_map<uint64_t, uint64_t> eventTimes_;
+  uint64_t nextEventId_ = 1;
+  bool inCallback_ = false;
+
+  bool tracing_ = false;
+  std::string tracePath_;
+  std::array<uint64_t, kNumOps> counts_ = {};
+  std::vector<Transaction> transactions_;
+  std::vector<uint8_t> payloadPool_;
+};
+
+} // namespace
+
+const char *opName(Op op) {
+  switch (op) {
+  case Op::GpioInit:
+    return "gpio_init";
+  case Op::GpioSetFunction:
+    return "gpio_set_function";
+  case Op::GpioSetDir:
+    return "gpio_set_dir";
+  case Op::GpioPut:
+    return "gpio_put";
+  case Op::GpioSetPulls:
+    return "gpio_set_pulls";
+  case Op::PwmSetClkdiv:
+    return "pwm_set_clkdiv";
+  case Op::PwmSetWrap:
+    return "pwm_set_wrap";
+  case Op::PwmSetLevel:
+    return "pwm_set_level";
+  case Op::PwmSetEnabled:
+    return "pwm_set_enabled";
+  case Op::AdcSelectInput:
+    return "adc_select_input";
+  case Op::AdcRead:
+    return "adc_read";
+  case Op::I2cInit:
+    return "i2c_init";
+  case Op::I2cWrite:
+    return "i2c_write";
+  case Op::PioSmInit:
+    return "pio_sm_init";
+  case Op::PioSmSetEnabled:
+    return "pio_sm_set_enabled";
+  case Op::PioPut:
+    return "pio_put";
+  case Op::PioExec:
+    return "pio_exec";
+  case Op::PioPush:
+    return "pio_push";
+  case Op::OneWireReset:
+    return "onewire_reset";
+  case Op::PwmSetCc:
+    return "pwm_set_cc";
+  }
+  return "?";
+}
+
+uint64_t now() { return Simulator::instance().now(); }
+
+void advanceTo(uint64_t timeUs) { Simulator::instance().advanceTo(timeUs); }
+
+void advanceBy(uint64_t us) { advanceTo(now() + us); }
+
+uint64_t nextEventTime() { return Simulator::instance().nextEventTime(); }
+
+void record(Op op, uint32_t a, uint32_t b, uint32_t c, const uint8_t *payload,
+            size_t size) {
+  Simulator::instance().record(now(), op, a, b, c, payload, size);
+}
+
+void recordAt(uint64_t timeUs, Op op, uint32_t a, uint32_t b, uint32_t c,
+              const uint8_t *payload, size_t size) {
+  Simulator::instance().record(timeUs, op, a, b, c, payload, size);
+}
+
+void setTracing(bool enabled) { Simulator::instance().setTracing(enabled); }
+
+const std::vector<Transaction> &transactions() {
+  return Simulator::instance().transactions();
+}
+
+const uint8_t *payload(const Transaction &transaction) {
+  return Simulator::instance().payload(transaction);
+}
+
+uint64_t count(Op op) { return Simulator::instance().count(op); }
+
+void clearTransactions() { Simulator::instance().clearTransactions(); }
+
+void setRunLimitUs(uint64_t limitUs) {
+  Simulator::instance().setRunLimitUs(limitUs);
+}
+
+uint64_t schedule(uint64_t timeUs, std::function<void()> callback) {
+  return Simulator::instance().schedule(timeUs, std::move(callback));
+}
+
+bool cancel(uint64_t id) { return Simulator::instance().cancel(id); }
+
+} // namespace pico_host
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "pico/host.h"
+
+namespace pico_host {
+
+// Moves the virtual clock forward, running every callback scheduled on the
+// way. This is what sleeps and blocking peripheral calls boil down to.
+void advanceTo(uint64_t timeUs);
+void advanceBy(uint64_t us);
+
+// Time of the earliest pending callback, or UINT64_MAX if there is none.
+uint64_t nextEventTime();
+
+// Core 1 (multicore.cpp) cannot run the event loop: it hands the CPU back to
+// core 0 until |timeUs|, or until the next event or __sev().
+bool onCore1();
+void core1SleepUntil(uint64_t timeUs);
+void core1WaitForEvent();
+
+void record(Op op, uint32_t a = 0, uint32_t b = 0, uint32_t c = 0,
+            const uint8_t *payload = nullptr, size_t size = 0);
+// Same, for transactions that completed in the background and are logged
+// after the fact with the time they started.
+void recordAt(uint64_t timeUs, Op op, uint32_t a = 0, uint32_t b = 0,
+              uint32_t c = 0, const uint8_t *payload = nullptr,
+              size_t size = 0);
+
+// DMA plumbing. A peripheral registers how fast it accepts or produces one
+// element for a DREQ (|pace| returns the earliest time >= |earliestNs| at
+// which the next element can move), and what happens when DMA writes to or
+// reads from one of its registers.
+void registerDreq(uint dreq,
+                  std::function<uint64_t(uint64_t earliestNs)> pace);
+// A |pace| that cannot tell yet, e.g. an RX FIFO waiting for data nobody has
+// sent, returns kDreqIdle; the peripheral calls signalDreq() once it can.
+constexpr uint64_t kDreqIdle = UINT64_MAX;
+void signalDreq(uint dreq);
+void registerWritePort(
+    const volatile void *address,
+    std::function<void(uint32_t value, uint64_t timeNs)> write);
+void registerReadPort(const volatile void *address,
+                      std::function<uint32_t(uint64_t timeNs)> read);
+
+// Runs the handlers attached to |num| if that IRQ is enabled.
+void raiseIrq(uint num);
+
+// Microseconds a transfer of |bits| takes at |hz|, rounded up.
+inline uint64_t bitTimeUs(uint64_t bits, uint64_t hz) {
+  return (bits * 1'000'000 + hz - 1) / hz;
+}
+
+} // namespace pico_host
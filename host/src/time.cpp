@@ -0,0 +1,157 @@
+#include "pico/time.h"
+
+#include "hardware/sync.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <unordered_map>
+
+#include "sim.h"
+
+namespace {
+
+struct Alarm {
+  alarm_callback_t callback;
+  void *userData;
+  uint64_t eventId;
+};
+
+std::unordered_map<alarm_id_t, Alarm> alarms;
+alarm_id_t nextAlarmId = 1;
+
+void arm(alarm_id_t id, absolute_time_t time);
+
+// Same rescheduling rules as the SDK: a positive return value counts from
+// now, a negative one from when the alarm was due.
+void fire(alarm_id_t id, absolute_time_t due) {
+  const auto it = alarms.find(id);
+  if (it == alarms.end()) {
+    return;
+  }
+  const int64_t again = it->second.callback(id, it->second.userData);
+  if (alarms.count(id) == 0) {
+    return;
+  }
+  if (again > 0) {
+    arm(id, pico_host::now() + again);
+  } else if (again < 0) {
+    arm(id, due - again);
+  } else {
+    alarms.erase(id);
+  }
+}
+
+void arm(alarm_id_t id, absolute_time_t time) {
+  const absolute_time_t due = std::max<absolute_time_t>(time, pico_host::now());
+  alarms[id].eventId =
+      pico_host::schedule(due, [id, time] { fire(id, time); });
+}
+
+} // namespace
+
+uint64_t time_us_64() { return pico_host::now(); }
+
+uint32_t time_us_32() { return static_cast<uint32_t>(pico_host::now()); }
+
+absolute_time_t get_absolute_time() { return pico_host::now(); }
+
+absolute_time_t make_timeout_time_us(uint64_t us) {
+  return pico_host::now() + us;
+}
+
+absolute_time_t make_timeout_time_ms(uint32_t ms) {
+  return pico_host::now() + 1000ull * ms;
+}
+
+void sleep_until(absolute_time_t target) { pico_host::advanceTo(target); }
+
+void sleep_us(uint64_t us) { pico_host::advanceBy(us); }
+
+void sleep_ms(uint32_t ms) { pico_host::advanceBy(1000ull * ms); }
+
+void busy_wait_us(uint64_t us) { pico_host::advanceBy(us); }
+
+void busy_wait_us_32(uint32_t us) { pico_host::advanceBy(us); }
+
+void tight_loop_contents() { pico_host::advanceBy(1); }
+
+void __wfe() {
+  if (pico_host::onCore1()) {
+    pico_host::core1WaitForEvent();
+    return;
+  }
+  const uint64_t next = pico_host::nextEventTime();
+  pico_host::advanceTo(next == UINT64_MAX ? pico_host::now() + 1 : next);
+}
+
+alarm_id_t add_alarm_at(absolute_time_t time, alarm_callback_t callback,
+                        void *user_data, bool fire_if_past) {
+  if (time <= pico_host::now() && !fire_if_past) {
+    return 0;
+  }
+  const alarm_id_t id = nextAlarmId++;
+  alarms[id] = {callback, user_data, 0};
+  arm(id, time);
+  return id;
+}
+
+alarm_id_t add_alarm_in_us(uint64_t us, alarm_callback_t callback,
+                           void *user_data, bool fire_if_past) {
+  return add_alarm_at(make_timeout_time_us(us), callback, user_data,
+                      fire_if_past);
+}
+
+alarm_id_t add_alarm_in_ms(uint32_t ms, alarm_callback_t callback,
+                           void *user_data, bool fire_if_past) {
+  return add_alarm_at(make_timeout_time_ms(ms), callback, user_data,
+                      fire_if_past);
+}
+
+namespace {
+
+int64_t onRepeatingTimer(alarm_id_t id, void *user_data) {
+  repeating_timer_t *timer = static_cast<repeating_timer_t *>(user_data);
+  if (!timer->callback(timer)) {
+    timer->alarm_id = 0;
+    return 0;
+  }
+  return timer->delay_us;
+}
+
+} // namespace
+
+bool add_repeating_timer_us(int64_t delay_us,
+                            repeating_timer_callback_t callback,
+                            void *user_data, repeating_timer_t *out) {
+  if (delay_us == 0) {
+    delay_us = 1;
+  }
+  out->delay_us = delay_us;
+  out->callback = callback;
+  out->user_data = user_data;
+  out->alarm_id = add_alarm_in_us(static_cast<uint64_t>(std::abs(delay_us)),
+                                  onRepeatingTimer, out, true);
+  return out->alarm_id > 0;
+}
+
+bool add_repeating_timer_ms(int32_t delay_ms,
+                            repeating_timer_callback_t callback,
+                            void *user_data, repeating_timer_t *out) {
+  return add_repeating_timer_us(1000ll * delay_ms, callback, user_data, out);
+}
+
+bool cancel_repeating_timer(repeating_timer_t *timer) {
+  const bool cancelled = timer->alarm_id && cancel_alarm(timer->alarm_id);
+  timer->alarm_id = 0;
+  return cancelled;
+}
+
+bool cancel_alarm(alarm_id_t alarm_id) {
+  const auto it = alarms.find(alarm_id);
+  if (it == alarms.end()) {
+    return false;
+  }
+  pico_host::cancel(it->second.eventId);
+  alarms.erase(it);
+  return true;
+}